@@ -101,6 +101,12 @@ typedef struct input_device
 void register_input_device(input_device_t *idev);
 uint32_t input_device_get_event(input_device_t *idev, input_device_event_t *event);
 
+// drivers notify from their interrupt handler, readers wait for a notification
+// newer than the count they saw before looking at the devices
+void input_device_notify(void);
+uint32_t input_device_notifications(void);
+void input_device_wait(uint32_t seen);
+
 input_device_t **get_input_devices();
 uint32_t get_num_input_devices();
 
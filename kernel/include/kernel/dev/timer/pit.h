@@ -0,0 +1,20 @@
+#ifndef __KERNEL_PIT_H
+#define __KERNEL_PIT_H
+
+#include <kernel/types.h>
+#include <kernel/interrupts.h>
+
+#define PIT_BASE_FREQUENCY 1193182
+
+// ticks is the number of timer periods that passed since the last call
+typedef void (*pit_tick_handler_t)(int_registers_t *regs, uint32_t ticks);
+
+uint32_t pit_init(uint32_t frequency, pit_tick_handler_t tick_handler);
+void pit_set_periodic(void);
+uint32_t pit_set_oneshot(uint32_t ticks);
+uint32_t pit_get_frequency(void);
+uint32_t pit_get_ticks(void);
+uint32_t pit_get_pending_ticks(void);
+void pit_wait(uint32_t count);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __KERNEL_FPU_H
+#define __KERNEL_FPU_H
+
+#include <kernel/types.h>
+
+#define FPU_STATE_SIZE 512 // fxsave area
+
+// x87, mmx and sse registers of a task, fxsave needs 16 byte alignment
+typedef struct
+{
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+struct _task;
+
+uint32_t fpu_init(void);
+void fpu_switch(struct _task *next);
+uint32_t fpu_handle_trap(void);
+uint32_t fpu_fork(struct _task *parent, struct _task *child);
+void fpu_release(struct _task *task);
+
+#endif
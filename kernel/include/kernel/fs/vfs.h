@@ -44,6 +44,8 @@ typedef struct fs_node
 
     logical_block_device_t *lbdev;
     void *fs_private_data;
+
+    uint32_t refcount; // close_fs only closes the node once the last reference goes
 } fs_node_t;
 
 struct dirent
@@ -53,9 +55,13 @@ struct dirent
 
 extern fs_node_t *fs_root;
 
+fs_node_t *alloc_fs_node(void);
+void free_fs_node(fs_node_t *node);
+
 uint32_t read_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 uint32_t write_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 fs_node_t *open_fs(const char *path);
+fs_node_t *dup_fs(fs_node_t *node);
 void close_fs(fs_node_t *node);
 struct dirent *readdir_fs(fs_node_t *node, uint32_t index);
 fs_node_t *finddir_fs(fs_node_t *node, const char *name);
@@ -5,13 +5,34 @@
 
 #define MINIMUM_ALLOCATION_SIZE 64
 
-uint32_t heap_init(void *virtual_address, uint32_t num_pages, uint32_t *kernel_page_directory);
+// record the caller of every allocation in the chunk header, shown by heap_dump_allocations()
+#ifndef HEAP_TRACK_ALLOCATION_SITES
+#define HEAP_TRACK_ALLOCATION_SITES 1
+#endif
+
+typedef struct
+{
+    uint32_t heap_size;
+    uint32_t bytes_in_use;
+    uint32_t peak_bytes_in_use;
+    uint32_t num_chunks;
+    uint32_t num_free_chunks;
+    uint32_t largest_free_chunk;
+    uint32_t num_allocations;
+    uint32_t num_frees;
+    uint64_t allocate_cycles; // time spent in allocate(), in TSC cycles
+} heap_stats_t;
+
+uint32_t heap_init(void *virtual_address, uint32_t num_pages, uint32_t max_pages, uint32_t *kernel_page_directory);
 
 void *kmalloc(uint32_t size);
-void *kmalloc_aligned(uint32_t alignment, uint32_t size); // TODO: Not yet implemented
+void *kmalloc_aligned(uint32_t alignment, uint32_t size);
 void *krealloc(void *ptr, uint32_t size);
 void *kcalloc(uint32_t num, uint32_t element_size);
 
 void kfree(void *ptr);
 
+void heap_get_stats(heap_stats_t *stats);
+void heap_dump_allocations(void);
+
 #endif
\ No newline at end of file
@@ -20,19 +20,33 @@
 #define IRQ14 46
 #define IRQ15 47
 
+// raised by kernel code that gives up the cpu, see task_yield
+#define INTERRUPT_YIELD 0x81
+
 uint32_t interrupts_init(void);
+void set_idt_gate(int n, uint32_t handler);
+void set_idt_gate_dpl(int n, uint8_t dpl);
 void enable_interrupts(void);
 void disable_interrupts(void);
+uint32_t interrupts_save(void);
+void interrupts_restore(uint32_t flags);
+void wait_for_interrupt(void);
 
+// trap frame built by the interrupt stubs, it is also how the state of a task
+// that is not running is kept on its kernel stack
 typedef struct
 {
-  uint32_t ds;
-  uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+  uint32_t gs, fs, es, ds;
+  uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; // pusha, esp is not restored
   uint32_t int_no, err_code;
-  uint32_t eip, cs, eflags, useresp, ss;
+  uint32_t eip, cs, eflags;
+  uint32_t useresp, ss; // only pushed when coming from user mode
 } int_registers_t;
 
-typedef void (*isr_t)(int_registers_t);
+// size of a frame that interrupted the kernel, without useresp and ss
+#define INT_REGISTERS_KERNEL_SIZE (sizeof(int_registers_t) - 2 * sizeof(uint32_t))
+
+typedef void (*isr_t)(int_registers_t *regs);
 void register_interrupt_handler(uint8_t n, isr_t handler);
 
 #endif
\ No newline at end of file
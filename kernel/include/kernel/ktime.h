@@ -0,0 +1,15 @@
+#ifndef __KERNEL_KTIME_H
+#define __KERNEL_KTIME_H
+
+#include <kernel/types.h>
+
+#define NSEC_PER_USEC 1000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+uint32_t ktime_init(void);
+uint64_t ktime_get_ns(void);
+uint64_t ktime_cycles_to_ns(uint64_t cycles);
+uint32_t ktime_get_tsc_khz(void);
+
+#endif
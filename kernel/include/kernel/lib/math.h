@@ -0,0 +1,10 @@
+#ifndef __KERNEL_MATH_H
+#define __KERNEL_MATH_H
+
+#include <kernel/types.h>
+
+// 64 by 32 bit division, the kernel is not linked against libgcc so a plain
+// 64 bit division does not link
+uint64_t div_u64(uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+
+#endif
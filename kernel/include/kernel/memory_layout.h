@@ -0,0 +1,19 @@
+#ifndef __KERNEL_MEMORY_LAYOUT_H
+#define __KERNEL_MEMORY_LAYOUT_H
+
+// 0x00000000 - 0xBFFFFFFF user space, private to every address space
+// 0xC0000000 - 0xDFFFFFFF kernel image and direct map of physical memory
+// 0xE0000000 - 0xEFFFFFFF kernel heap
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define KERNEL_DIRECT_MAP_SIZE 0x20000000
+#define KERNEL_HEAP_VADDR 0xE0000000
+#define KERNEL_HEAP_MAX_SIZE 0x10000000
+
+#define KERNEL_USER_SPACE_END KERNEL_VIRTUAL_BASE
+
+#ifndef ASM_FILE
+#define PHYS_TO_VIRT(addr) ((void *)((uint32_t)(addr) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(addr) ((void *)((uint32_t)(addr) - KERNEL_VIRTUAL_BASE))
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __KERNEL_MUTEX_H
+#define __KERNEL_MUTEX_H
+
+#include <kernel/types.h>
+#include <kernel/wait.h>
+
+// sleeping lock, must not be taken from interrupt handlers
+typedef struct
+{
+    bool locked;
+    task_t *owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+bool mutex_trylock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+#endif
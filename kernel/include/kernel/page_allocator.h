@@ -4,10 +4,22 @@
 #include <kernel/types.h>
 #include <kernel/multiboot2.h>
 
+// largest block handed out by the buddy allocator is (1 << PAGE_ALLOC_MAX_ORDER) pages (4 MiB)
+#define PAGE_ALLOC_MAX_ORDER 10
+
 uint32_t page_alloc_init(struct multiboot_tag_mmap *mmap, uint32_t mmap_size);
 void *page_alloc(void);
+void *page_alloc_order(uint32_t order);
+void *page_alloc_contiguous(uint32_t count);
 void page_free(void *ptr);
+void page_free_contiguous(void *ptr, uint32_t count);
 void page_reserve(void *ptr);
+
+// allocated blocks start with one reference, page_free drops one and only
+// releases the block when it was the last
+void page_ref(void *ptr);
+uint32_t page_get_refcount(void *ptr);
 uint32_t get_num_pages(void);
+uint32_t get_num_free_pages(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -4,21 +4,41 @@
 #include <kernel/types.h>
 #include <kernel/page_allocator.h>
 
+#define PAGING_COPY_ON_WRITE 0b010000000000 // available bit, read only table entry that is copied on the first write
+// available bit, directory entry points at a kernel page table. every kernel
+// half entry (768 - 1023) is filled in by paging_init and never changes, so the
+// copies made by page_directory_create stay valid and mappings added to a
+// shared table show up in every directory
+#define PAGING_SHARED_TABLE 0b001000000000
+#define PAGING_GLOBAL 0b000100000000        // kept in the TLB across CR3 reloads (PGE)
+#define PAGING_LARGE_PAGE 0b10000000        // directory entry maps a 4 MiB page (PSE)
 #define PAGING_CACHE_DISABLED 0b00010000
 #define PAGING_WRITE_THROUGH 0b00001000
 #define PAGING_ACCESS_FROM_ALL 0b00000100
 #define PAGING_IS_WRITEABLE 0b00000010
 #define PAGING_IS_PRESENT 0b00000001
 
+// page fault error code bits
+#define PAGING_FAULT_PRESENT 0b001
+#define PAGING_FAULT_WRITE 0b010
+#define PAGING_FAULT_USER 0b100
+
 #define PAGING_TOTAL_ENTRIES_PER_TABLE 1024
+#define PAGING_LARGE_PAGE_SIZE (PAGING_TOTAL_ENTRIES_PER_TABLE * PAGE_SIZE)
 
-uint32_t *page_directory_create(uint8_t flags);
+uint32_t *paging_init(void);
+uint32_t *page_directory_create(void);
+uint32_t *page_directory_fork(uint32_t *page_directory);
 void page_directory_free(uint32_t *page_directory);
 void paging_switch_directory(uint32_t *directory);
-uint32_t paging_map_range(uint32_t *directory, void *virt, void *phys, uint32_t count, uint8_t flags);
-uint32_t paging_map_to(uint32_t *directory, void *virt, void *phys, void *phys_end, uint8_t flags);
-uint32_t paging_map(uint32_t *directory, void *virt, void *phys, uint8_t flags);
+uint32_t paging_map_range(uint32_t *directory, void *virt, void *phys, uint32_t count, uint32_t flags);
+uint32_t paging_map_to(uint32_t *directory, void *virt, void *phys, void *phys_end, uint32_t flags);
+uint32_t paging_map(uint32_t *directory, void *virt, void *phys, uint32_t flags);
+uint32_t paging_unmap(uint32_t *directory, void *virt);
 void *paging_get_phys_address(uint32_t *directory, void *virt);
+void paging_invalidate_page(void *virt);
+uint32_t paging_handle_fault(void *virt, uint32_t error_code);
+uint32_t paging_kernel_flags(void);
 
 void *paging_align_address(void *ptr);
 
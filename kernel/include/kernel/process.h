@@ -2,10 +2,11 @@
 #define __KERNEL_PROCESS_H
 
 #define KERNEL_MAX_PROCESSES 128
-#define KERNEL_MAX_PROCESS_PAGE_ALLOCATIONS 1024
 
 #include <kernel/types.h>
 #include <kernel/task.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/vm_area.h>
 
 typedef struct _process
 {
@@ -13,13 +14,15 @@ typedef struct _process
     char path[128];
 
     task_t *task;
-    void *page_allocations[KERNEL_MAX_PROCESS_PAGE_ALLOCATIONS]; // physical addresses
-    void *data;
-    void *stack;
-    uint32_t size; // size of "data"
-} __attribute__((packed)) process_t;
+    fs_node_t *image; // executable, paged in on demand at KERNEL_TASK_VADDR. a reference of its own, the file areas use it
+    uint32_t size;    // size of "image"
+    vm_area_t *areas; // image, stack, ... sorted by address
+} process_t;
 
 process_t *process_current();
 uint32_t process_load(const char *path, process_t **process);
+uint32_t process_fork(process_t *parent, const int_registers_t *frame, process_t **process);
+uint32_t process_handle_fault(process_t *process, void *virt, uint32_t error_code);
+void process_exit(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef __KERNEL_SEMAPHORE_H
+#define __KERNEL_SEMAPHORE_H
+
+#include <kernel/types.h>
+#include <kernel/wait.h>
+
+typedef struct
+{
+    uint32_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+void semaphore_init(semaphore_t *semaphore, uint32_t count);
+void semaphore_down(semaphore_t *semaphore);
+bool semaphore_down_timeout(semaphore_t *semaphore, uint32_t ticks);
+bool semaphore_trydown(semaphore_t *semaphore);
+void semaphore_up(semaphore_t *semaphore);
+
+#endif
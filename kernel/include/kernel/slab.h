@@ -0,0 +1,38 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include <kernel/types.h>
+
+#define KMEM_CACHE_SLAB_SIZE PAGE_SIZE
+#define KMEM_CACHE_NAME_LENGTH 32
+
+typedef void (*kmem_cache_ctor_t)(void *object);
+
+struct kmem_slab;
+
+typedef struct kmem_cache
+{
+    char name[KMEM_CACHE_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t slot_size;   // object plus the free list link
+    uint32_t link_offset; // placed behind the object when a constructor is used
+    uint32_t objects_per_slab;
+    kmem_cache_ctor_t ctor;
+
+    struct kmem_slab *partial; // slabs with at least one free object
+    struct kmem_slab *full;
+    uint32_t num_slabs;
+    uint32_t num_empty;
+    uint32_t num_active;
+
+    struct kmem_cache *next;
+} kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size, kmem_cache_ctor_t ctor);
+void kmem_cache_destroy(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+
+kmem_cache_t *kmem_cache_list(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __KERNEL_SYSCALL_H
+#define __KERNEL_SYSCALL_H
+
+#include <kernel/types.h>
+#include <kernel/interrupts.h>
+
+// calling convention, the same for both entry points:
+//   eax: syscall number, ebx, esi, edi: arguments, eax: result
+// sysenter additionally takes the return address in edx and the user stack in ecx,
+// int 0x80 preserves every register but eax. both entries save the caller in an
+// int_registers_t at the top of the kernel stack of the task
+#define SYSCALL_INTERRUPT 0x80
+#define SYSCALL_MAX 64
+
+#define SYSCALL_WRITE 0  // (const char *buffer, uint32_t size)
+#define SYSCALL_GETPID 1 // ()
+#define SYSCALL_FORK 2   // (), the child pid in the parent, 0 in the child and -1 on failure
+
+// regs is the frame of the caller, most handlers only need the arguments
+typedef uint32_t (*syscall_handler_t)(int_registers_t *regs, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+uint32_t syscall_init(uint32_t kernel_stack);
+uint32_t syscall_register(uint32_t number, syscall_handler_t handler);
+uint32_t syscall_dispatch(int_registers_t *regs);
+
+// architecture specific entry setup
+void syscall_arch_init(uint32_t kernel_stack);
+void syscall_set_kernel_stack(uint32_t kernel_stack);
+
+#endif
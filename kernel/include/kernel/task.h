@@ -3,54 +3,84 @@
 
 #include <kernel/types.h>
 #include <kernel/paging.h>
+#include <kernel/interrupts.h>
+#include <kernel/fpu.h>
+#include <kernel/timer.h>
 
 #define KERNEL_TASK_VADDR 0x400000
 #define KERNEL_TASK_STACK_VADDR 0x3FF000
-#define KERNEL_TASK_STACK_SIZE (1024 * 16)
+#define KERNEL_TASK_STACK_SIZE (1024 * 1024) // reserved, pages are only allocated when touched
+#define KERNEL_TASK_TIME_SLICE 5              // timer ticks a task runs before it is preempted
+#define KERNEL_TASK_KERNEL_STACK_SIZE 8192    // interrupts from the task are handled on this stack
 
-typedef struct
-{
-    uint32_t edi;
-    uint32_t esi;
-    uint32_t ebp;
-    uint32_t ebx;
-    uint32_t edx;
-    uint32_t ecx;
-    uint32_t eax;
-
-    uint32_t ip;
-    uint32_t cs;
-    uint32_t flags;
-    uint32_t esp;
-    uint32_t ss;
-} __attribute__((packed)) task_registers_t;
+// nice values map to priority levels, a lower value is scheduled first
+#define TASK_NICE_MIN -20
+#define TASK_NICE_MAX 19
+#define TASK_PRIORITY_LEVELS (TASK_NICE_MAX - TASK_NICE_MIN + 1)
+
+#define TASK_READY 0    // waiting in a run queue
+#define TASK_RUNNING 1  // current task
+#define TASK_BLOCKED 2  // waiting on wait_queue for task_unblock
+#define TASK_SLEEPING 3 // waiting for its sleep timer
+#define TASK_DEAD 4     // exited, freed once it is no longer running
+
+typedef void (*task_entry_t)(void *arg);
 
 struct _process;
 typedef struct _task
 {
     uint32_t *page_directory;
-    task_registers_t registers;
 
-    struct _process *process;
+    void *kernel_stack;     // bottom of the kernel stack, it is KERNEL_TASK_KERNEL_STACK_SIZE bytes
+    int_registers_t *frame; // where the task continues, on its kernel stack while it is not running
+    fpu_state_t *fpu_state; // allocated on the first fpu instruction, NULL before
+
+    struct _process *process; // NULL for kernel threads
+
+    // kernel threads run entry(arg) in ring 0 on the kernel page directory
+    task_entry_t entry;
+    void *arg;
 
-    // double linked list
+    uint32_t state;
+    int32_t nice;
+    timer_t sleep_timer; // makes a sleeping task ready again
+    uint32_t time_slice; // ticks left before the task is preempted
+    uint32_t ticks;      // ticks the task has been running in total
+
+    // links of the run queue or state list the task is on
     struct _task *next;
     struct _task *prev;
+    struct task_queue *wait_queue; // list a blocked task is on
 } task_t;
 
+typedef struct task_queue
+{
+    task_t *head;
+    task_t *tail;
+} task_queue_t;
+
 task_t *task_current();
 task_t *task_get_next();
 
 task_t *task_new(struct _process *process);
+task_t *task_fork(task_t *parent, struct _process *process, const int_registers_t *frame);
+task_t *task_new_kernel_thread(task_entry_t entry, void *arg, int32_t nice);
 void task_free(task_t *task);
 uint32_t task_init(task_t *task, struct _process *process);
 
+void task_set_nice(task_t *task, int32_t nice);
+void task_block(task_t *task);
+void task_block_on(task_t *task, task_queue_t *queue);
+void task_unblock(task_t *task);
+void task_sleep(task_t *task, uint32_t ticks);
+void task_block_timeout(task_t *task, task_queue_t *queue, uint32_t ticks);
+void task_yield(void);
+void task_exit(void);
+
 uint32_t task_switch(task_t *task);
-uint32_t task_page();
 void task_run_first_task();
-
-void task_return(task_registers_t *regs);
-void restore_gp_registers(task_registers_t *regs);
-void user_registers();
+void task_program_timer(void);
+void schedule(int_registers_t *regs, uint32_t ticks);
+int_registers_t *task_interrupt_return(int_registers_t *regs);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef __KERNEL_TIMER_H
+#define __KERNEL_TIMER_H
+
+#include <kernel/types.h>
+
+// the wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots, a slot on
+// level n covers TIMER_WHEEL_SIZE^n ticks. timers are inserted into the level
+// their expiry falls into and moved down a level whenever the level below
+// wraps around, so adding, removing and expiring a timer is O(1)
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_DELAY ((1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+struct timer;
+typedef void (*timer_func_t)(struct timer *timer);
+
+// func runs in interrupt context once the tick count reaches expires
+typedef struct timer
+{
+    uint32_t expires;
+    timer_func_t func;
+    void *data;
+
+    struct timer **slot; // NULL while the timer is not pending
+    struct timer *next;
+    struct timer *prev;
+} timer_t;
+
+void timer_init(timer_t *timer, timer_func_t func, void *data);
+void timer_add(timer_t *timer, uint32_t expires);
+void timer_mod(timer_t *timer, uint32_t ticks);
+void timer_del(timer_t *timer);
+bool timer_pending(timer_t *timer);
+
+void timer_advance(uint32_t ticks);
+uint32_t timer_next_event(void);
+uint32_t timer_get_ticks(void);
+void timer_program(uint32_t ticks);
+uint32_t timer_ms_to_ticks(uint32_t ms);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __KERNEL_TSC_H
+#define __KERNEL_TSC_H
+
+#include <kernel/types.h>
+
+static inline uint64_t tsc_read(void)
+{
+    uint32_t low;
+    uint32_t high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+bool tsc_available(void);
+uint32_t tsc_calibrate(void);
+
+#endif
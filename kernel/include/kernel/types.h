@@ -21,6 +21,9 @@ void kprintf(const char *message, ...);
 
 #define PAGE_SIZE 4096
 
+// the structure that embeds member at ptr
+#define container_of(ptr, type, member) ((type *)((uintptr_t)(ptr) - offsetof(type, member)))
+
 #define EOK 0
 #define EIO 1
 #define EINVARG 2
@@ -0,0 +1,31 @@
+#ifndef __KERNEL_VM_AREA_H
+#define __KERNEL_VM_AREA_H
+
+#include <kernel/types.h>
+#include <kernel/fs/vfs.h>
+
+#define VM_AREA_WRITE 0x01
+#define VM_AREA_USER 0x02
+
+// a range of user space that is backed on demand, either by a file or by zeroed pages
+typedef struct vm_area
+{
+    uint32_t start; // page aligned
+    uint32_t end;   // page aligned, exclusive
+    uint32_t flags;
+
+    fs_node_t *file; // NULL for anonymous memory
+    uint32_t file_offset;
+    uint32_t file_size; // bytes of the file mapped at start, the rest is zero filled
+
+    struct vm_area *next; // sorted by start address
+} vm_area_t;
+
+uint32_t vm_area_insert(vm_area_t **areas, uint32_t start, uint32_t end, uint32_t flags, fs_node_t *file, uint32_t file_offset, uint32_t file_size);
+vm_area_t *vm_area_find(vm_area_t *areas, uint32_t address);
+uint32_t vm_area_clone(vm_area_t *areas, vm_area_t **clone);
+void vm_area_free_all(vm_area_t **areas);
+
+uint32_t vm_area_fault(vm_area_t *area, uint32_t *directory, void *virt, uint32_t error_code);
+
+#endif
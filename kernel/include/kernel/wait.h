@@ -0,0 +1,54 @@
+#ifndef __KERNEL_WAIT_H
+#define __KERNEL_WAIT_H
+
+#include <kernel/types.h>
+#include <kernel/task.h>
+#include <kernel/interrupts.h>
+
+// tasks waiting for an event, woken in the order they went to sleep
+typedef struct
+{
+    task_queue_t tasks;
+} wait_queue_t;
+
+void wait_queue_init(wait_queue_t *queue);
+void sleep_on(wait_queue_t *queue);
+void wake_up(wait_queue_t *queue);
+void wake_up_all(wait_queue_t *queue);
+uint32_t sleep_on_timeout(wait_queue_t *queue, uint32_t ticks);
+
+void sleep_ticks(uint32_t ticks);
+void sleep_ms(uint32_t ms);
+
+// sleeps until condition is true. it is checked with interrupts disabled so a
+// wake_up from an interrupt handler between the check and the sleep is not lost
+#define wait_event(queue, condition)                 \
+    do                                               \
+    {                                                \
+        uint32_t __wait_flags = interrupts_save();   \
+        while (!(condition))                         \
+        {                                            \
+            sleep_on(queue);                         \
+        }                                            \
+        interrupts_restore(__wait_flags);            \
+    } while (0)
+
+// like wait_event, but gives up after timeout ticks. evaluates to 0 when the
+// condition is still false then, otherwise to the ticks that were left, at least 1
+#define wait_event_timeout(queue, condition, timeout)                \
+    ({                                                               \
+        uint32_t __wait_left = (timeout);                            \
+        uint32_t __wait_flags = interrupts_save();                   \
+        while (!(condition) && __wait_left > 0)                      \
+        {                                                            \
+            __wait_left = sleep_on_timeout(queue, __wait_left);      \
+        }                                                            \
+        if ((condition) && __wait_left == 0)                         \
+        {                                                            \
+            __wait_left = 1;                                         \
+        }                                                            \
+        interrupts_restore(__wait_flags);                            \
+        __wait_left;                                                 \
+    })
+
+#endif
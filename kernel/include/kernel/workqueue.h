@@ -0,0 +1,37 @@
+#ifndef __KERNEL_WORKQUEUE_H
+#define __KERNEL_WORKQUEUE_H
+
+#include <kernel/types.h>
+#include <kernel/task.h>
+#include <kernel/wait.h>
+
+#define WORKQUEUE_SYSTEM_NICE -10 // deferred interrupt work runs before user tasks
+
+struct work;
+typedef void (*work_func_t)(struct work *work);
+
+// embedded in the structure the work operates on, func gets it back through the argument
+typedef struct work
+{
+    work_func_t func;
+    bool pending; // queued and not started yet
+    struct work *next;
+} work_t;
+
+// work items are run one after another by a kernel thread
+typedef struct
+{
+    task_t *worker;
+    wait_queue_t wait; // the worker sleeps here while the queue is empty
+    work_t *head;
+    work_t *tail;
+} workqueue_t;
+
+void work_init(work_t *work, work_func_t func);
+
+uint32_t workqueue_init(void);
+workqueue_t *workqueue_create(int32_t nice);
+workqueue_t *workqueue_system(void);
+bool workqueue_queue(workqueue_t *queue, work_t *work);
+
+#endif
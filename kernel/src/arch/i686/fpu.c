@@ -0,0 +1,165 @@
+#include <kernel/fpu.h>
+#include <kernel/task.h>
+#include <kernel/heap.h>
+#include <kernel/lib/string.h>
+
+#define CR0_MP 0x00000002 // wait and fwait trap on TS too
+#define CR0_EM 0x00000004 // every fpu instruction traps
+#define CR0_TS 0x00000008 // the next fpu instruction traps, set on task switches
+#define CR0_NE 0x00000020 // report x87 errors with #MF instead of the pic
+
+#define CR4_OSFXSR 0x00000200     // fxsave/fxrstor and sse
+#define CR4_OSXMMEXCPT 0x00000400 // sse errors raise #XM
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+// the state every task starts with, taken right after fninit
+static fpu_state_t fpu_initial_state;
+
+// task whose state is loaded in the fpu, it may not be the running one
+static task_t *fpu_owner = NULL;
+
+static uint32_t read_cr0(void)
+{
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static void write_cr0(uint32_t cr0)
+{
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+}
+
+static void fpu_save(fpu_state_t *state)
+{
+    __asm__ volatile("fxsave (%0)" : : "r"(state) : "memory");
+}
+
+static void fpu_restore(fpu_state_t *state)
+{
+    __asm__ volatile("fxrstor (%0)" : : "r"(state) : "memory");
+}
+
+uint32_t fpu_init(void)
+{
+    uint32_t eax = 1;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    if (!(edx & CPUID_FXSR))
+    {
+        return EHRDWRE;
+    }
+
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR;
+    if (edx & CPUID_SSE)
+    {
+        cr4 |= CR4_OSXMMEXCPT;
+    }
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    __asm__ volatile("fninit");
+    fpu_save(&fpu_initial_state);
+
+    // nobody owns the fpu yet, the first task to use it traps
+    write_cr0(read_cr0() | CR0_TS);
+
+    return EOK;
+}
+
+// the state is not touched on a switch, the next task traps on its first fpu
+// instruction unless its state is still loaded
+void fpu_switch(task_t *next)
+{
+    if (next == fpu_owner)
+    {
+        __asm__ volatile("clts");
+    }
+    else
+    {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+}
+
+// device not available (#NM), hand the fpu to the current task
+uint32_t fpu_handle_trap(void)
+{
+    task_t *task = task_current();
+    if (!task || (read_cr0() & CR0_EM))
+    {
+        return EINVARG;
+    }
+
+    // tasks that never use the fpu do not get a save area
+    if (!task->fpu_state)
+    {
+        task->fpu_state = kmalloc_aligned(16, sizeof(fpu_state_t));
+        if (!task->fpu_state)
+        {
+            return ENOMEM;
+        }
+
+        memcpy(task->fpu_state, &fpu_initial_state, sizeof(fpu_state_t));
+    }
+
+    __asm__ volatile("clts");
+    if (fpu_owner == task)
+    {
+        return EOK;
+    }
+
+    if (fpu_owner)
+    {
+        fpu_save(fpu_owner->fpu_state);
+    }
+
+    fpu_restore(task->fpu_state);
+    fpu_owner = task;
+
+    return EOK;
+}
+
+uint32_t fpu_fork(task_t *parent, task_t *child)
+{
+    child->fpu_state = NULL;
+    if (!parent->fpu_state)
+    {
+        return EOK;
+    }
+
+    child->fpu_state = kmalloc_aligned(16, sizeof(fpu_state_t));
+    if (!child->fpu_state)
+    {
+        return ENOMEM;
+    }
+
+    // the registers of the owner are newer than its save area
+    if (fpu_owner == parent)
+    {
+        uint32_t cr0 = read_cr0();
+        __asm__ volatile("clts");
+        fpu_save(parent->fpu_state);
+        write_cr0(cr0);
+    }
+
+    memcpy(child->fpu_state, parent->fpu_state, sizeof(fpu_state_t));
+    return EOK;
+}
+
+void fpu_release(task_t *task)
+{
+    if (fpu_owner == task)
+    {
+        fpu_owner = NULL;
+    }
+
+    kfree(task->fpu_state);
+    task->fpu_state = NULL;
+}
@@ -35,6 +35,12 @@ void set_idt_gate(int n, uint32_t handler)
   idt[n].offset_high = high_16(handler);
 }
 
+// lowest privilege level that may raise the interrupt with int
+void set_idt_gate_dpl(int n, uint8_t dpl)
+{
+  idt[n].flags = (idt[n].flags & ~0x60) | ((dpl & 0x03) << 5);
+}
+
 uint32_t interrupts_init(void)
 {
   isr_install();
@@ -56,3 +62,31 @@ void disable_interrupts(void)
 {
   __asm__("cli");
 }
+
+// disables interrupts and returns the previous eflags for interrupts_restore,
+// for code that may run both with and without interrupts enabled
+uint32_t interrupts_save(void)
+{
+  uint32_t flags;
+  __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+void interrupts_restore(uint32_t flags)
+{
+  if (flags & 0x200)
+  {
+    __asm__ volatile("sti" : : : "memory");
+  }
+  else
+  {
+    __asm__ volatile("cli" : : : "memory");
+  }
+}
+
+// sti only takes effect after the next instruction, so an interrupt can not
+// slip in between enabling interrupts and halting
+void wait_for_interrupt(void)
+{
+  __asm__ volatile("sti; hlt");
+}
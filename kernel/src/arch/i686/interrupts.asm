@@ -3,48 +3,53 @@
 [extern isr_handler]
 [extern irq_handler]
 
+; both stubs build an int_registers_t on the stack and pass a pointer to it.
+; the handler returns the frame to resume, which is a different one when it
+; switched tasks, so switching only swaps the stack pointer
 isr_common_stub:
-	pusha ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
-	mov ax, ds ; Lower 16-bits of eax = ds.
-	push eax ; save the data segment descriptor
-	mov ax, 0x10  ; kernel data segment descriptor
-	mov ds, ax
-	mov es, ax
-	mov fs, ax
-	mov gs, ax
-	
-	call isr_handler
-	
-	pop eax 
-	mov ds, ax
-	mov es, ax
-	mov fs, ax
-	mov gs, ax
-	popa
-	add esp, 8 ; Cleans up the pushed error code and pushed ISR number
-	sti
-	iret ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+  pusha
+  push ds
+  push es
+  push fs
+  push gs
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+
+  push esp
+  call isr_handler
+  mov esp, eax
+  jmp interrupt_return
 
 irq_common_stub:
-  pusha 
-  mov ax, ds
-  push eax
+  pusha
+  push ds
+  push es
+  push fs
+  push gs
   mov ax, 0x10
   mov ds, ax
   mov es, ax
   mov fs, ax
   mov gs, ax
+
+  push esp
   call irq_handler
-  pop ebx
-  mov ds, bx
-  mov es, bx
-  mov fs, bx
-  mov gs, bx
+  mov esp, eax
+
+; expects esp to point at an int_registers_t, also used to enter a task for the first time
+interrupt_return:
+  pop gs
+  pop fs
+  pop es
+  pop ds
   popa
-  add esp, 8
-  sti
-  iret 
-	
+  add esp, 8 ; Cleans up the pushed error code and pushed ISR number
+  iret
+
+global interrupt_return
 global isr0
 global isr1
 global isr2
@@ -94,6 +99,7 @@ global irq12
 global irq13
 global irq14
 global irq15
+global irq_yield
 
 ; 0: Divide By Zero Exception
 isr0:
@@ -409,3 +415,10 @@ irq15:
 	push byte 15
 	push byte 47
 	jmp irq_common_stub
+
+; software interrupt kernel code raises to give up the cpu
+irq_yield:
+	cli
+	push byte 0
+	push dword 0x81
+	jmp irq_common_stub
@@ -1,4 +1,7 @@
 #include <kernel/interrupts.h>
+#include <kernel/fpu.h>
+#include <kernel/paging.h>
+#include <kernel/process.h>
 #include <kernel/tty.h>
 #include <kernel/lib/ascii.h>
 #include <kernel/ports.h>
@@ -52,8 +55,7 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
-
-void set_idt_gate(int n, uint32_t handler);
+extern void irq_yield();
 
 void isr_install()
 {
@@ -119,6 +121,8 @@ void isr_install()
     set_idt_gate(45, (uint32_t)irq13);
     set_idt_gate(46, (uint32_t)irq14);
     set_idt_gate(47, (uint32_t)irq15);
+
+    set_idt_gate(INTERRUPT_YIELD, (uint32_t)irq_yield);
 }
 
 static const char *exception_messages[] = {
@@ -158,40 +162,70 @@ static const char *exception_messages[] = {
     "reserved",
     "reserved"};
 
-extern uint32_t *kernel_page_directory;
+#define ISR_DEVICE_NOT_AVAILABLE 7
+#define ISR_PAGE_FAULT 14
 
-void isr_handler(int_registers_t r)
+int_registers_t *isr_handler(int_registers_t *r)
 {
-    paging_switch_directory(kernel_page_directory);
+    if (r->int_no == ISR_DEVICE_NOT_AVAILABLE && fpu_handle_trap() == EOK)
+    {
+        return r;
+    }
+
+    if (r->int_no == ISR_PAGE_FAULT)
+    {
+        void *fault_address;
+        __asm__ volatile("mov %%cr2, %0" : "=r"(fault_address));
+        if (paging_handle_fault(fault_address, r->err_code) == EOK ||
+            process_handle_fault(process_current(), fault_address, r->err_code) == EOK)
+        {
+            return r;
+        }
+
+        // a bad access from user mode only ends the process that made it
+        process_t *process = process_current();
+        if ((r->err_code & PAGING_FAULT_USER) && process)
+        {
+            kprintf("process %d: page fault at 0x%x, EIP: 0x%x\n", process->id, (uint32_t)fault_address, r->eip);
+            process_exit();
+        }
+    }
+
     PANIC_CODE(kprintf("received interrupt: %i\n%s exception\nerror code: %i\nEIP: 0x%x\nESP: 0x%x\nSS: 0x%x\nCS: 0x%x\nEFLAGS: 0x%x\nDS: 0x%x",
-                       r.int_no,
-                       exception_messages[r.int_no],
-                       r.err_code,
-                       r.eip,
-                       r.esp,
-                       r.ss,
-                       r.cs,
-                       r.eflags,
-                       r.ds));
+                       r->int_no,
+                       exception_messages[r->int_no],
+                       r->err_code,
+                       r->eip,
+                       r->useresp,
+                       r->ss,
+                       r->cs,
+                       r->eflags,
+                       r->ds));
+    return r;
 }
 
 static isr_t interrupt_handlers[256];
 
-void irq_handler(int_registers_t r)
+// returns the frame the stub resumes, the scheduler may have picked another task
+int_registers_t *irq_handler(int_registers_t *r)
 {
-    paging_switch_directory(kernel_page_directory);
-
-    if (interrupt_handlers[r.int_no] != 0)
+    if (interrupt_handlers[r->int_no] != 0)
     {
-        isr_t handler = interrupt_handlers[r.int_no];
+        isr_t handler = interrupt_handlers[r->int_no];
         handler(r);
     }
 
-    if (r.int_no >= 40)
+    // software interrupts are not acknowledged
+    if (r->int_no >= IRQ0 && r->int_no <= IRQ15)
     {
-        port_byte_out(0xA0, 0x20);
+        if (r->int_no >= IRQ8)
+        {
+            port_byte_out(0xA0, 0x20);
+        }
+        port_byte_out(0x20, 0x20);
     }
-    port_byte_out(0x20, 0x20);
+
+    return task_interrupt_return(r);
 }
 
 void register_interrupt_handler(uint8_t n, isr_t handler)
@@ -4,6 +4,7 @@ section .text
 
 global paging_load_directory
 global paging_enable
+global paging_enable_global
 
 paging_load_directory:
   push ebp
@@ -21,3 +22,12 @@ paging_enable:
   mov cr0, eax
   pop ebp
   ret
+
+paging_enable_global:
+  push ebp
+  mov ebp, esp
+  mov eax, cr4
+  or eax, 0x80
+  mov cr4, eax
+  pop ebp
+  ret
@@ -1,26 +1,160 @@
 #include <kernel/paging.h>
+#include <kernel/memory_layout.h>
 #include <kernel/tty.h>
 #include <kernel/lib/cast.h>
+#include <kernel/lib/string.h>
 
 extern void paging_load_directory(uint32_t *directory);
+extern void paging_enable_global(void);
 
 static uint32_t *current_directory = 0;
+static uint32_t *kernel_directory = 0;
+static uint32_t kernel_global_flag = 0;
 
-uint32_t *page_directory_create(uint8_t flags)
+// tables are handed out as direct map pointers, directory entries hold the
+// physical address
+static uint32_t *paging_alloc_table(void)
 {
-#warning this may cause an error when colliding with a mapped memory reagion (eg. kernel allocator)
-    uint32_t *directory = page_alloc();
+    uint32_t *table = PHYS_TO_VIRT(page_alloc());
+    memset(table, 0, PAGE_SIZE);
+    return table;
+}
+
+static uint32_t *paging_entry_table(uint32_t entry)
+{
+    return PHYS_TO_VIRT(entry & 0xFFFFF000);
+}
+
+static bool paging_pge_supported(void)
+{
+    uint32_t eax = 1;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & (1 << 13)) != 0;
+}
+
+void paging_invalidate_page(void *virt)
+{
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// flags for kernel mappings, these are the same in every directory and are
+// marked global so that switching directories does not flush them
+uint32_t paging_kernel_flags(void)
+{
+    return PAGING_IS_PRESENT | PAGING_IS_WRITEABLE | kernel_global_flag;
+}
+
+// kernel half directory entries, these are the same in every directory
+static bool paging_is_kernel_entry(uint32_t directory_index)
+{
+    return directory_index >= KERNEL_VIRTUAL_BASE / PAGING_LARGE_PAGE_SIZE;
+}
+
+uint32_t *paging_init(void)
+{
+    kernel_directory = paging_alloc_table();
+
+    if (paging_pge_supported())
+    {
+        paging_enable_global();
+        kernel_global_flag = PAGING_GLOBAL;
+    }
+
+    // map physical memory at KERNEL_VIRTUAL_BASE with 4 MiB pages (PSE is
+    // already enabled by the boot code), these entries are shared with every
+    // directory created afterwards. the lower half stays empty for user space
+    uint32_t num_tables = (get_num_pages() + PAGING_TOTAL_ENTRIES_PER_TABLE - 1) / PAGING_TOTAL_ENTRIES_PER_TABLE;
+    if (num_tables > KERNEL_DIRECT_MAP_SIZE / PAGING_LARGE_PAGE_SIZE)
+    {
+        num_tables = KERNEL_DIRECT_MAP_SIZE / PAGING_LARGE_PAGE_SIZE;
+    }
+
+    uint32_t first = KERNEL_VIRTUAL_BASE / PAGING_LARGE_PAGE_SIZE;
+    for (uint32_t i = 0; i < num_tables; i++)
+    {
+        kernel_directory[first + i] = (i * PAGING_LARGE_PAGE_SIZE) | paging_kernel_flags() | PAGING_LARGE_PAGE;
+    }
 
-    uint32_t offset = 0;
+    // every other kernel half entry gets its table now, directories only copy
+    // the kernel entries when they are created so none may be added later
+    for (uint32_t i = first; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++)
+    {
+        if (!(kernel_directory[i] & PAGING_IS_PRESENT))
+        {
+            kernel_directory[i] = (uint32_t)VIRT_TO_PHYS(paging_alloc_table()) | PAGING_IS_PRESENT | PAGING_IS_WRITEABLE;
+        }
+    }
+
+    return kernel_directory;
+}
+
+uint32_t *page_directory_create(void)
+{
+    uint32_t *directory = paging_alloc_table();
+
+    // point at the kernel page tables instead of copying them
     for (uint32_t i = 0; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++)
     {
-        uint32_t *table = page_alloc();
+        if (kernel_directory[i] & PAGING_IS_PRESENT)
+        {
+            directory[i] = kernel_directory[i] | PAGING_SHARED_TABLE;
+        }
+    }
+
+    return directory;
+}
+
+// user space mappings hold a reference on their frame, see page_directory_fork
+static bool paging_is_user_table(uint32_t *directory, uint32_t directory_index)
+{
+    uint32_t entry = directory[directory_index];
+    return directory_index < KERNEL_USER_SPACE_END / PAGING_LARGE_PAGE_SIZE &&
+           (entry & PAGING_IS_PRESENT) && !(entry & (PAGING_SHARED_TABLE | PAGING_LARGE_PAGE));
+}
+
+uint32_t *page_directory_fork(uint32_t *page_directory)
+{
+    uint32_t *directory = page_directory_create();
+
+    for (uint32_t i = 0; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++)
+    {
+        if (!paging_is_user_table(page_directory, i))
+        {
+            continue;
+        }
+
+        uint32_t *parent_table = paging_entry_table(page_directory[i]);
+        uint32_t *table = paging_alloc_table();
+
+        // both sides get a read only mapping of the same frame, whoever writes
+        // first gets a private copy in paging_handle_fault
         for (uint32_t j = 0; j < PAGING_TOTAL_ENTRIES_PER_TABLE; j++)
         {
-            table[j] = (offset + (j * PAGE_SIZE)) | flags;
+            uint32_t entry = parent_table[j];
+            if (!(entry & PAGING_IS_PRESENT))
+            {
+                continue;
+            }
+
+            if (entry & PAGING_IS_WRITEABLE)
+            {
+                entry = (entry & ~PAGING_IS_WRITEABLE) | PAGING_COPY_ON_WRITE;
+                parent_table[j] = entry;
+
+                if (page_directory == current_directory)
+                {
+                    paging_invalidate_page((void *)((i * PAGING_TOTAL_ENTRIES_PER_TABLE + j) * PAGE_SIZE));
+                }
+            }
+
+            page_ref((void *)(entry & 0xFFFFF000));
+            table[j] = entry;
         }
-        offset += (PAGING_TOTAL_ENTRIES_PER_TABLE * PAGE_SIZE);
-        directory[i] = (uint32_t)table | flags | PAGING_IS_WRITEABLE;
+
+        directory[i] = (uint32_t)VIRT_TO_PHYS(table) | (page_directory[i] & 0xFFF);
     }
 
     return directory;
@@ -28,20 +162,41 @@ uint32_t *page_directory_create(uint8_t flags)
 
 void page_directory_free(uint32_t *page_directory)
 {
-    for (uint32_t i = 0; i < 1024; i++)
+    for (uint32_t i = 0; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++)
     {
         uint32_t entry = page_directory[i];
-        uint32_t *table = (uint32_t *)(entry & 0xFFFFF000);
+        if (!(entry & PAGING_IS_PRESENT) || (entry & (PAGING_SHARED_TABLE | PAGING_LARGE_PAGE)))
+        {
+            continue;
+        }
+
+        if (paging_is_user_table(page_directory, i))
+        {
+            uint32_t *table = paging_entry_table(entry);
+            for (uint32_t j = 0; j < PAGING_TOTAL_ENTRIES_PER_TABLE; j++)
+            {
+                if (table[j] & PAGING_IS_PRESENT)
+                {
+                    page_free((void *)(table[j] & 0xFFFFF000));
+                }
+            }
+        }
 
-        page_free(table);
+        page_free((void *)(entry & 0xFFFFF000));
     }
 
-    page_free(page_directory);
+    page_free(VIRT_TO_PHYS(page_directory));
 }
 
 void paging_switch_directory(uint32_t *directory)
 {
-    paging_load_directory(directory);
+    // reloading CR3 flushes every non global TLB entry, skip it when nothing changes
+    if (directory == current_directory)
+    {
+        return;
+    }
+
+    paging_load_directory(VIRT_TO_PHYS(directory));
     current_directory = directory;
 }
 
@@ -83,14 +238,43 @@ uint32_t paging_set(uint32_t *directory, void *virt, uint32_t val)
     }
 
     uint32_t entry = directory[directory_index];
-    uint32_t *table = (uint32_t *)(entry & 0xFFFFF000);
+    if (paging_is_kernel_entry(directory_index))
+    {
+        // kernel tables are shared, the change is seen through every directory.
+        // the direct map is never remapped, splitting a 4 MiB page here would
+        // only change this directory
+        if (entry & PAGING_LARGE_PAGE)
+        {
+            return EINVARG;
+        }
+    }
+    else if (!(entry & PAGING_IS_PRESENT))
+    {
+        if (val == 0)
+        {
+            return EOK;
+        }
+
+        entry = (uint32_t)VIRT_TO_PHYS(paging_alloc_table()) | PAGING_IS_PRESENT | PAGING_IS_WRITEABLE | PAGING_ACCESS_FROM_ALL;
+        directory[directory_index] = entry;
+    }
+
+    uint32_t *table = paging_entry_table(entry);
 
+    uint32_t old_val = table[table_index];
     table[table_index] = val;
 
+    // non present entries are never cached. kernel mappings are shared with
+    // every directory and global, so they are invalidated whichever one is loaded
+    if ((old_val & PAGING_IS_PRESENT) && (directory == current_directory || paging_is_kernel_entry(directory_index)))
+    {
+        paging_invalidate_page(virt);
+    }
+
     return EOK;
 }
 
-uint32_t paging_map_range(uint32_t *directory, void *virt, void *phys, uint32_t count, uint8_t flags)
+uint32_t paging_map_range(uint32_t *directory, void *virt, void *phys, uint32_t count, uint32_t flags)
 {
     uint32_t res = EOK;
     for (uint32_t i = 0; i < count; i++)
@@ -108,7 +292,7 @@ uint32_t paging_map_range(uint32_t *directory, void *virt, void *phys, uint32_t
     return res;
 }
 
-uint32_t paging_map_to(uint32_t *directory, void *virt, void *phys, void *phys_end, uint8_t flags)
+uint32_t paging_map_to(uint32_t *directory, void *virt, void *phys, void *phys_end, uint32_t flags)
 {
     uint32_t res = EOK;
     if (!paging_is_aligned(virt) || !paging_is_aligned(phys) || !paging_is_aligned(phys_end))
@@ -131,7 +315,7 @@ out:
     return res;
 }
 
-uint32_t paging_map(uint32_t *directory, void *virt, void *phys, uint8_t flags)
+uint32_t paging_map(uint32_t *directory, void *virt, void *phys, uint32_t flags)
 {
     if (!paging_is_aligned(virt) || !paging_is_aligned(phys))
     {
@@ -141,6 +325,11 @@ uint32_t paging_map(uint32_t *directory, void *virt, void *phys, uint8_t flags)
     return paging_set(directory, virt, (uint32_t)phys | flags);
 }
 
+uint32_t paging_unmap(uint32_t *directory, void *virt)
+{
+    return paging_set(directory, virt, 0);
+}
+
 void *paging_get_phys_address(uint32_t *directory, void *virt)
 {
     if (!paging_is_aligned(virt))
@@ -163,7 +352,12 @@ void *paging_get_phys_address(uint32_t *directory, void *virt)
         return NULL; // Page table not present
     }
 
-    uint32_t *table = (uint32_t *)(entry & 0xFFFFF000);
+    if (entry & PAGING_LARGE_PAGE)
+    {
+        return (void *)((entry & 0xFFC00000) + ((uint32_t)virt % PAGING_LARGE_PAGE_SIZE));
+    }
+
+    uint32_t *table = paging_entry_table(entry);
     uint32_t page_entry = table[table_index];
     if (!(page_entry & PAGING_IS_PRESENT))
     {
@@ -177,6 +371,50 @@ void *paging_get_phys_address(uint32_t *directory, void *virt)
     return (void *)phys_address;
 }
 
+uint32_t paging_handle_fault(void *virt, uint32_t error_code)
+{
+    // only writes to present copy on write pages are handled here
+    if ((error_code & (PAGING_FAULT_PRESENT | PAGING_FAULT_WRITE)) != (PAGING_FAULT_PRESENT | PAGING_FAULT_WRITE))
+    {
+        return EINVARG;
+    }
+
+    void *page = (void *)((uint32_t)virt & ~(PAGE_SIZE - 1));
+    uint32_t directory_index = 0;
+    uint32_t table_index = 0;
+    paging_get_indices(page, &directory_index, &table_index);
+
+    uint32_t directory_entry = current_directory[directory_index];
+    if (!(directory_entry & PAGING_IS_PRESENT) || (directory_entry & PAGING_LARGE_PAGE))
+    {
+        return EINVARG;
+    }
+
+    uint32_t *table = paging_entry_table(directory_entry);
+    uint32_t entry = table[table_index];
+    if (!(entry & PAGING_COPY_ON_WRITE))
+    {
+        return EINVARG;
+    }
+
+    void *frame = (void *)(entry & 0xFFFFF000);
+    uint32_t flags = (entry & 0xFFF & ~PAGING_COPY_ON_WRITE) | PAGING_IS_WRITEABLE;
+
+    // the last mapping of a frame can simply take it over
+    if (page_get_refcount(frame) > 1)
+    {
+        void *copy = page_alloc();
+        memcpy(PHYS_TO_VIRT(copy), PHYS_TO_VIRT(frame), PAGE_SIZE);
+        page_free(frame);
+        frame = copy;
+    }
+
+    table[table_index] = (uint32_t)frame | flags;
+    paging_invalidate_page(page);
+
+    return EOK;
+}
+
 void *paging_align_address(void *ptr)
 {
     if (paging_is_aligned(ptr))
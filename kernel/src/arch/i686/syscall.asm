@@ -0,0 +1,92 @@
+[bits 32]
+
+section .text
+
+[extern syscall_handler]
+[extern interrupt_return]
+[extern tss]
+
+TSS_ESP0 equ 4
+SYSCALL_INTERRUPT equ 0x80
+
+global syscall_sysenter_entry
+global syscall_interrupt_entry
+
+; sysenter loads cs, ss, esp and eip from the MSRs and disables interrupts,
+; the caller passes its return address in edx and its stack in ecx
+syscall_sysenter_entry:
+  ; the MSR stack is shared by all tasks, continue on the kernel stack of the
+  ; running task like int 0x80 does so the syscall can block. ds still belongs
+  ; to user mode, ss is already the kernel data segment
+  mov esp, [ss:tss + TSS_ESP0]
+
+  ; build the frame an int 0x80 from user mode would have left, the flags are
+  ; saved with interrupts enabled since sysenter cleared them
+  push dword 0x23
+  push ecx
+  pushfd
+  or dword [esp], 0x200
+  push dword 0x1B
+  push edx
+  push byte 0
+  push dword SYSCALL_INTERRUPT
+
+  pusha
+  push ds
+  push es
+  push fs
+  push gs
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+
+  push esp
+  call syscall_handler
+  add esp, 4
+
+  ; another frame is resumed with iret when the syscall switched tasks, that
+  ; task may not expect edx and ecx to be clobbered
+  cmp eax, esp
+  jne .switch
+
+  pop gs
+  pop fs
+  pop es
+  pop ds
+  popa
+  add esp, 8
+
+  mov edx, [esp]      ; eip
+  mov ecx, [esp + 12] ; user esp
+  add esp, 8
+  ; sti takes effect after sysexit, so the kernel stack is left before any interrupt
+  and dword [esp], ~0x200
+  popfd
+  sti
+  sysexit
+
+.switch:
+  mov esp, eax
+  jmp interrupt_return
+
+syscall_interrupt_entry:
+  push byte 0
+  push dword SYSCALL_INTERRUPT
+
+  pusha
+  push ds
+  push es
+  push fs
+  push gs
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+
+  push esp
+  call syscall_handler
+  mov esp, eax
+  jmp interrupt_return
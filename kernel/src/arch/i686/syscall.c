@@ -0,0 +1,70 @@
+#include <kernel/syscall.h>
+#include <kernel/interrupts.h>
+#include <kernel/segmentation.h>
+#include <kernel/task.h>
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+extern void syscall_sysenter_entry(void);
+extern void syscall_interrupt_entry(void);
+
+static bool sysenter_supported = false;
+
+static void write_msr(uint32_t msr, uint32_t low, uint32_t high)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"(low), "d"(high));
+}
+
+static bool syscall_sysenter_supported(void)
+{
+    uint32_t eax = 1;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    // family 6 models before 3 report SEP without implementing it
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    return (edx & (1 << 11)) && !(family == 6 && model < 3);
+}
+
+// both entry stubs end up here with the frame of the caller, the result goes
+// into its eax and the returned frame is resumed like after an interrupt
+int_registers_t *syscall_handler(int_registers_t *regs)
+{
+    regs->eax = syscall_dispatch(regs);
+    return task_interrupt_return(regs);
+}
+
+void syscall_arch_init(uint32_t kernel_stack)
+{
+    // int 0x80 always works, user mode may raise it directly
+    set_idt_gate(SYSCALL_INTERRUPT, (uint32_t)syscall_interrupt_entry);
+    set_idt_gate_dpl(SYSCALL_INTERRUPT, 3);
+
+    sysenter_supported = syscall_sysenter_supported();
+    if (!sysenter_supported)
+    {
+        return;
+    }
+
+    // sysexit returns to MSR_SYSENTER_CS + 16 and + 24, which are the user
+    // code and data segments in our gdt
+    write_msr(MSR_SYSENTER_CS, KERNEL_CODE_SELECTOR, 0);
+    write_msr(MSR_SYSENTER_EIP, (uint32_t)syscall_sysenter_entry, 0);
+
+    // only used until the entry moved to the stack of the running task, so it
+    // does not have to be rewritten on every task switch
+    syscall_set_kernel_stack(kernel_stack);
+}
+
+void syscall_set_kernel_stack(uint32_t kernel_stack)
+{
+    if (sysenter_supported)
+    {
+        write_msr(MSR_SYSENTER_ESP, kernel_stack, 0);
+    }
+}
@@ -1,70 +0,0 @@
-[bits 32]
-
-section .text
-
-global restore_gp_registers
-global task_return
-global user_registers
-
-task_return:
-  mov ebp, esp
-  ; PUSH THE DATA SEGMENT (SS WILL BE FINE)
-  ; PUSH THE STACK ADDRESS
-  ; PUSH THE FLAGS
-  ; PUSH THE CODE SEGMENT
-  ; PUSH IP
-
-  ; Let's access the structure passed to us
-  mov ebx, [ebp+4]
-  ; push the data/stack selector
-  push dword [ebx+44]
-  ; Push the stack pointer
-  push dword [ebx+40]
-
-  ; Push the flags
-  pushf
-  pop eax
-  or eax, 0x200
-  push eax
-
-  ; Push the code segment
-  push dword [ebx+32]
-
-  ; Push the IP to execute
-  push dword [ebx+28]
-
-  ; Setup some segment registers
-  mov ax, [ebx+44]
-  mov ds, ax
-  mov es, ax
-  mov fs, ax
-  mov gs, ax
-
-  push dword [ebp+4]
-  call restore_gp_registers
-  add esp, 4
-
-  ; Let's leave kernel land and execute in user land!
-  iretd
-    
-restore_gp_registers:
-  push ebp
-  mov ebp, esp
-  mov ebx, [ebp+8]
-  mov edi, [ebx]
-  mov esi, [ebx+4]
-  mov ebp, [ebx+8]
-  mov edx, [ebx+16]
-  mov ecx, [ebx+20]
-  mov eax, [ebx+24]
-  mov ebx, [ebx+12]
-  add esp, 4
-  ret
-
-user_registers:
-  mov ax, 0x23
-  mov ds, ax
-  mov es, ax
-  mov fs, ax
-  mov gs, ax
-  ret
@@ -0,0 +1,37 @@
+#include <kernel/tsc.h>
+#include <kernel/interrupts.h>
+#include <kernel/dev/timer/pit.h>
+#include <kernel/lib/math.h>
+
+#define CPUID_TSC (1 << 4)
+
+#define TSC_CALIBRATION_MS 10
+
+bool tsc_available(void)
+{
+    uint32_t eax = 1;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    return edx & CPUID_TSC;
+}
+
+// counts the cycles that pass during a known number of pit periods, returns
+// the frequency in kHz or 0 when there is no tsc
+uint32_t tsc_calibrate(void)
+{
+    if (!tsc_available())
+    {
+        return 0;
+    }
+
+    uint32_t flags = interrupts_save();
+    uint64_t start = tsc_read();
+    pit_wait(PIT_BASE_FREQUENCY / 1000 * TSC_CALIBRATION_MS);
+    uint64_t cycles = tsc_read() - start;
+    interrupts_restore(flags);
+
+    return (uint32_t)div_u64(cycles, TSC_CALIBRATION_MS, NULL);
+}
@@ -3,6 +3,10 @@
 #include <kernel/ports.h>
 #include <kernel/tty.h>
 #include <kernel/lib/cast.h>
+#include <kernel/mutex.h>
+#include <kernel/wait.h>
+#include <kernel/ktime.h>
+#include <kernel/interrupts.h>
 
 #define ATA_SR_BSY 0x80
 #define ATA_SR_DRDY 0x40
@@ -75,6 +79,11 @@
 #define ATA_REG_ALTSTATUS 0x0C
 #define ATA_REG_DEVADDRESS 0x0D
 
+// the device control and alternate status register sit in a separate block
+#define ATA_CONTROL_PORT(bus) ((bus) + 0x206)
+#define ATA_CONTROL_NIEN 0x02 // no interrupts from the drive
+#define ATA_CONTROL_SRST 0x04 // software reset of both drives on the channel
+
 // Channels:
 #define ATA_PRIMARY 0x00
 #define ATA_SECONDARY 0x01
@@ -107,23 +116,48 @@ typedef struct
 #define IDE_DEVICE_FLAG_MASTER 1 << 0
 #define IDE_DEVICE_FLAG_PRESENT 1 << 1
 
+// both drives of a channel share its registers and its irq
+typedef struct
+{
+    uint16_t bus;
+    uint8_t irq;
+    volatile bool busy;      // a command is running and a task waits for its irq
+    volatile uint8_t status; // read by the irq handler, which acknowledges the interrupt
+    wait_queue_t wait;
+} ide_channel_t;
+
 typedef struct
 {
     uint16_t bus;
     uint8_t flags;
+    ide_channel_t *channel;
 } ide_device_private_data_t;
 
+#define ATA_TIMEOUT_MS 5000 // a drive that stays busy longer is considered dead
+#define ATA_RESET_MS 2      // until the drives set BSY after a reset
+
 static uint16_t ide_buses[] = {0x1F0,
                                0x1F0,
                                0x170,
                                0x170};
 
+static ide_channel_t ide_channels[] = {{.bus = 0x1F0, .irq = IRQ14},
+                                       {.bus = 0x170, .irq = IRQ15}};
+
+// one command at a time, a task waiting for the drive sleeps until its irq
+static mutex_t ide_lock;
+
+static ide_channel_t *ide_channel(uint16_t bus)
+{
+    return &ide_channels[bus == ide_channels[0].bus ? 0 : 1];
+}
+
 static void ata_io_wait(uint16_t bus)
 {
-    port_byte_in(bus + ATA_REG_ALTSTATUS);
-    port_byte_in(bus + ATA_REG_ALTSTATUS);
-    port_byte_in(bus + ATA_REG_ALTSTATUS);
-    port_byte_in(bus + ATA_REG_ALTSTATUS);
+    port_byte_in(ATA_CONTROL_PORT(bus));
+    port_byte_in(ATA_CONTROL_PORT(bus));
+    port_byte_in(ATA_CONTROL_PORT(bus));
+    port_byte_in(ATA_CONTROL_PORT(bus));
 }
 
 static void ata_select(uint16_t bus, bool master)
@@ -131,24 +165,119 @@ static void ata_select(uint16_t bus, bool master)
     port_byte_out(bus + ATA_REG_HDDEVSEL, master ? 0xA0 : 0xB0);
 }
 
-static void ata_wait_ready(uint16_t bus)
+// returns 1 when the drive is still busy after ATA_TIMEOUT_MS. only used where
+// no interrupt is raised and before the first task runs, nothing can sleep then
+static int ata_wait_ready(uint16_t bus)
 {
-    while (port_byte_in(bus + ATA_REG_STATUS) & ATA_SR_BSY)
-        ;
+    uint64_t deadline = ktime_get_ns() + (uint64_t)ATA_TIMEOUT_MS * NSEC_PER_MSEC;
+    while (port_byte_in(ATA_CONTROL_PORT(bus)) & ATA_SR_BSY)
+    {
+        if (ktime_get_ns() > deadline)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-static int ata_wait(uint16_t bus, int advanced)
+// commands only interrupt once there is a task that can sleep until then
+static void ata_start_command(ide_channel_t *channel)
 {
-    uint8_t status = 0;
+    channel->busy = true;
+    port_byte_out(ATA_CONTROL_PORT(channel->bus), task_current() ? 0x00 : ATA_CONTROL_NIEN);
+}
 
+// waits for the end of a command started with ata_start_command, returns 1 on
+// a timeout or when the drive reported an error. data is set for commands
+// that leave a sector to read, the caller transfers it itself
+static int ata_wait_irq(ide_channel_t *channel, bool data)
+{
+    if (!task_current())
+    {
+        if (ata_wait_ready(channel->bus))
+        {
+            channel->busy = false;
+            return 1;
+        }
+
+        channel->status = port_byte_in(channel->bus + ATA_REG_STATUS);
+        channel->busy = false;
+    }
+    else
+    {
+        uint32_t ticks = timer_ms_to_ticks(ATA_TIMEOUT_MS);
+        while (true)
+        {
+            ticks = wait_event_timeout(&channel->wait, !channel->busy, ticks);
+            if (ticks == 0)
+            {
+                channel->busy = false;
+                return 1;
+            }
+
+            // an interrupt left over from a command that timed out may arrive
+            // before this one set BSY, keep waiting for the drive then
+            uint32_t flags = interrupts_save();
+            bool ready = !(port_byte_in(ATA_CONTROL_PORT(channel->bus)) & ATA_SR_BSY);
+            if (!ready)
+            {
+                channel->busy = true;
+            }
+            interrupts_restore(flags);
+
+            if (ready)
+            {
+                break;
+            }
+        }
+    }
+
+    if (channel->status & (ATA_SR_ERR | ATA_SR_DF))
+    {
+        return 1;
+    }
+
+    return data && !(channel->status & ATA_SR_DRQ);
+}
+
+static void ide_irq(int_registers_t *regs)
+{
+    ide_channel_t *channel = &ide_channels[regs->int_no == ide_channels[0].irq ? 0 : 1];
+
+    channel->status = port_byte_in(channel->bus + ATA_REG_STATUS);
+    if (!channel->busy || (channel->status & ATA_SR_BSY))
+    {
+        return;
+    }
+
+    channel->busy = false;
+    wake_up(&channel->wait);
+}
+
+// brings a channel that timed out back into a known state
+static void ata_reset(ide_channel_t *channel)
+{
+    port_byte_out(ATA_CONTROL_PORT(channel->bus), ATA_CONTROL_SRST | ATA_CONTROL_NIEN);
+    ata_io_wait(channel->bus);
+    port_byte_out(ATA_CONTROL_PORT(channel->bus), ATA_CONTROL_NIEN);
+
+    sleep_ms(ATA_RESET_MS);
+    ata_wait_ready(channel->bus);
+}
+
+static int ata_wait(uint16_t bus, int advanced)
+{
     ata_io_wait(bus);
 
-    while ((status = port_byte_in(bus + ATA_REG_STATUS)) & ATA_SR_BSY)
-        ;
+    if (ata_wait_ready(bus))
+    {
+        return 1;
+    }
 
     if (advanced)
     {
-        status = port_byte_in(bus + ATA_REG_STATUS);
+        uint8_t status = port_byte_in(bus + ATA_REG_STATUS);
         if (status & ATA_SR_ERR)
         {
             return 1;
@@ -169,7 +298,7 @@ static int ata_wait(uint16_t bus, int advanced)
 static uint32_t ide_device_identify(uint16_t bus, uint8_t flags)
 {
     port_byte_out(bus + 1, 1);
-    port_byte_out(bus + 0x306, 0);
+    port_byte_out(ATA_CONTROL_PORT(bus), ATA_CONTROL_NIEN);
 
     ata_select(bus + ATA_REG_HDDEVSEL, flags & IDE_DEVICE_FLAG_MASTER);
     ata_io_wait(bus);
@@ -184,7 +313,10 @@ static uint32_t ide_device_identify(uint16_t bus, uint8_t flags)
         return 0;
     }
 
-    ata_wait_ready(bus);
+    if (ata_wait_ready(bus))
+    {
+        return 0;
+    }
 
     ata_identify_t device;
     uint16_t *buf = (uint16_t *)&device;
@@ -194,13 +326,19 @@ static uint32_t ide_device_identify(uint16_t bus, uint8_t flags)
         buf[i] = port_word_in(bus);
     }
 
-    port_byte_out(bus + ATA_REG_CONTROL, 0x02);
-
     return buf[60] | (buf[61] << 16);
 }
 
 uint32_t ide_driver_init()
 {
+    mutex_init(&ide_lock);
+
+    for (uint32_t i = 0; i < sizeof(ide_channels) / sizeof(ide_channels[0]); i++)
+    {
+        wait_queue_init(&ide_channels[i].wait);
+        register_interrupt_handler(ide_channels[i].irq, ide_irq);
+    }
+
     return EOK;
 }
 
@@ -227,6 +365,7 @@ uint32_t ide_driver_scan_disks()
         ide_device_private_data_t *private_data = kmalloc(sizeof(ide_device_private_data_t));
         private_data->bus = bus;
         private_data->flags = flags | IDE_DEVICE_FLAG_PRESENT;
+        private_data->channel = ide_channel(bus);
 
         block_device_t *bdev = kmalloc(sizeof(block_device_t));
         bdev->block_size = 512;
@@ -242,16 +381,19 @@ uint32_t ide_driver_scan_disks()
     return EOK;
 }
 
-uint32_t ide_write_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
+static uint32_t ide_write_block_locked(block_device_t *bdev, uint32_t lba, uint8_t *buf)
 {
     ide_device_private_data_t *private_data = bdev->implementation.private_data;
     bool master = !(private_data->flags & IDE_DEVICE_FLAG_MASTER);
+    ide_channel_t *channel = private_data->channel;
     uint16_t bus = private_data->bus;
 
-    port_byte_out(bus + ATA_REG_CONTROL, 0x02);
-
-    ata_wait_ready(bus);
+    if (ata_wait_ready(bus))
+    {
+        return EHRDWRE;
+    }
 
+    ata_start_command(channel);
     port_byte_out(bus + ATA_REG_HDDEVSEL, (master ? 0xE0 : 0xF0) | ((lba & 0x0f000000) >> 24));
     ata_wait(bus, 0);
     port_byte_out(bus + ATA_REG_FEATURES, 0x00);
@@ -260,7 +402,12 @@ uint32_t ide_write_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
     port_byte_out(bus + ATA_REG_LBA1, (lba & 0x0000ff00) >> 8);
     port_byte_out(bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
     port_byte_out(bus + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-    ata_wait(bus, 0);
+
+    // the drive asks for the data without an interrupt, that one comes after it was written
+    if (ata_wait(bus, 1))
+    {
+        return EHRDWRE;
+    }
 
     uint16_t *write_buf = (uint16_t *)buf;
     for (uint32_t i = 0; i < 256; i++)
@@ -269,22 +416,36 @@ uint32_t ide_write_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
         port_word_out(bus, data);
     }
 
-    port_byte_out(bus + 0x07, ATA_CMD_CACHE_FLUSH);
-    ata_wait(bus, 0);
+    if (ata_wait_irq(channel, false))
+    {
+        ata_reset(channel);
+        return EHRDWRE;
+    }
+
+    ata_start_command(channel);
+    port_byte_out(bus + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    if (ata_wait_irq(channel, false))
+    {
+        ata_reset(channel);
+        return EHRDWRE;
+    }
 
     return EOK;
 }
 
-uint32_t ide_read_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
+static uint32_t ide_read_block_locked(block_device_t *bdev, uint32_t lba, uint8_t *buf)
 {
     ide_device_private_data_t *private_data = bdev->implementation.private_data;
     bool master = !(private_data->flags & IDE_DEVICE_FLAG_MASTER);
+    ide_channel_t *channel = private_data->channel;
     uint16_t bus = private_data->bus;
 
-    port_byte_out(bus + ATA_REG_CONTROL, 0x02);
-
-    ata_wait_ready(bus);
+    if (ata_wait_ready(bus))
+    {
+        return EHRDWRE;
+    }
 
+    ata_start_command(channel);
     port_byte_out(bus + ATA_REG_HDDEVSEL, (master ? 0xE0 : 0xF0) | ((lba & 0x0f000000) >> 24));
     port_byte_out(bus + ATA_REG_FEATURES, 0x00);
     port_byte_out(bus + ATA_REG_SECCOUNT0, 1);
@@ -293,8 +454,9 @@ uint32_t ide_read_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
     port_byte_out(bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
     port_byte_out(bus + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
 
-    if (ata_wait(bus, 1))
+    if (ata_wait_irq(channel, true))
     {
+        ata_reset(channel);
         PANIC_PRINT("error during ATA read");
         return EHRDWRE;
     }
@@ -305,7 +467,23 @@ uint32_t ide_read_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
         read_buf[i] = port_word_in(bus);
     }
 
-    ata_wait(bus, 0);
-
     return EOK;
 }
+
+uint32_t ide_write_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
+{
+    mutex_lock(&ide_lock);
+    uint32_t res = ide_write_block_locked(bdev, lba, buf);
+    mutex_unlock(&ide_lock);
+
+    return res;
+}
+
+uint32_t ide_read_block(block_device_t *bdev, uint32_t lba, uint8_t *buf)
+{
+    mutex_lock(&ide_lock);
+    uint32_t res = ide_read_block_locked(bdev, lba, buf);
+    mutex_unlock(&ide_lock);
+
+    return res;
+}
@@ -7,13 +7,14 @@
 uint8_t *keycache = 0;
 uint16_t key_loc = 0;
 
-void keyboard_irq(int_registers_t)
+void keyboard_irq(int_registers_t *)
 {
     if (key_loc >= 255)
     {
         return;
     }
     keycache[key_loc++] = port_byte_in(0x60);
+    input_device_notify();
 }
 
 uint32_t keyboard_ps2_init(input_device_t *idev)
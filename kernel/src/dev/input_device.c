@@ -1,8 +1,12 @@
 #include <kernel/dev/input_device.h>
+#include <kernel/wait.h>
 
 static input_device_t *input_devices[MAX_INPUT_DEVICES];
 static uint32_t num_input_devices = 0;
 
+static volatile uint32_t input_notifications = 0;
+static wait_queue_t input_wait;
+
 void register_input_device(input_device_t *idev)
 {
     input_devices[num_input_devices++] = idev;
@@ -22,3 +26,19 @@ uint32_t get_num_input_devices()
 {
     return num_input_devices;
 }
+
+void input_device_notify(void)
+{
+    input_notifications++;
+    wake_up_all(&input_wait);
+}
+
+uint32_t input_device_notifications(void)
+{
+    return input_notifications;
+}
+
+void input_device_wait(uint32_t seen)
+{
+    wait_event(&input_wait, input_notifications != seen);
+}
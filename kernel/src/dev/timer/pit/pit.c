@@ -0,0 +1,202 @@
+#include <kernel/dev/timer/pit.h>
+#include <kernel/ports.h>
+
+#define PIT_CHANNEL0_DATA 0x40
+#define PIT_CHANNEL2_DATA 0x42
+#define PIT_COMMAND 0x43
+#define PIT_SPEAKER_CONTROL 0x61
+
+#define PIT_CHANNEL0 0x00
+#define PIT_CHANNEL2 0x80
+#define PIT_ACCESS_LOW_HIGH 0x30
+#define PIT_MODE_TERMINAL_COUNT 0x00
+#define PIT_MODE_RATE_GENERATOR 0x04
+#define PIT_READ_BACK_CHANNEL0 0xC2 // latches the status and the count of channel 0
+
+#define PIT_STATUS_OUT 0x80        // the one shot reached its terminal count
+#define PIT_STATUS_NULL_COUNT 0x40 // the new count is not loaded into the counter yet
+
+#define PIT_SPEAKER_GATE 0x01 // channel 2 counts while set
+#define PIT_SPEAKER_DATA 0x02 // connects channel 2 to the speaker
+#define PIT_CHANNEL2_OUT 0x20 // output of channel 2
+
+// the counter is 16 bits wide, 0 stands for 65536
+#define PIT_MAX_COUNT 0x10000
+#define PIT_MIN_COUNT 64 // a one shot that is already due still needs some time to arm
+
+static uint32_t pit_frequency = 0;
+static uint32_t pit_divisor = 0;
+static volatile uint32_t pit_ticks = 0;
+static pit_tick_handler_t pit_tick_handler = NULL;
+
+// a one shot counts from the input clock cycles that passed since the last
+// tick (pit_carry) on, so reprogramming it early does not lose time
+static bool pit_oneshot = false;
+static uint32_t pit_count = 0; // of the running one shot, 0 once it was accounted
+static uint32_t pit_carry = 0;
+
+static void pit_program(uint8_t mode, uint32_t count)
+{
+    port_byte_out(PIT_COMMAND, PIT_CHANNEL0 | PIT_ACCESS_LOW_HIGH | mode);
+    port_byte_out(PIT_CHANNEL0_DATA, count & 0xFF);
+    port_byte_out(PIT_CHANNEL0_DATA, (count >> 8) & 0xFF);
+}
+
+// input clock cycles since the last tick
+static uint32_t pit_elapsed(void)
+{
+    if (!pit_oneshot)
+    {
+        port_byte_out(PIT_COMMAND, PIT_CHANNEL0);
+        uint32_t count = port_byte_in(PIT_CHANNEL0_DATA);
+        count |= port_byte_in(PIT_CHANNEL0_DATA) << 8;
+        return count ? pit_divisor - count : 0;
+    }
+
+    if (pit_count == 0)
+    {
+        return pit_carry;
+    }
+
+    port_byte_out(PIT_COMMAND, PIT_READ_BACK_CHANNEL0);
+    uint8_t status = port_byte_in(PIT_CHANNEL0_DATA);
+    uint32_t count = port_byte_in(PIT_CHANNEL0_DATA);
+    count |= port_byte_in(PIT_CHANNEL0_DATA) << 8;
+
+    if (status & PIT_STATUS_NULL_COUNT)
+    {
+        return pit_carry;
+    }
+
+    // the counter wraps around after the terminal count
+    if ((status & PIT_STATUS_OUT) || count > pit_count)
+    {
+        return pit_carry + pit_count;
+    }
+
+    return pit_carry + pit_count - count;
+}
+
+static void pit_irq(int_registers_t *r)
+{
+    // a one shot interrupt stands for all the periods it covered
+    uint32_t ticks = 1;
+    if (pit_oneshot)
+    {
+        uint32_t count = pit_carry + pit_count;
+        ticks = count / pit_divisor;
+        pit_carry = count % pit_divisor;
+        pit_count = 0;
+    }
+    pit_ticks += ticks;
+
+    if (pit_tick_handler)
+    {
+        pit_tick_handler(r, ticks);
+    }
+}
+
+uint32_t pit_init(uint32_t frequency, pit_tick_handler_t tick_handler)
+{
+    if (frequency == 0 || frequency > PIT_BASE_FREQUENCY)
+    {
+        return EINVARG;
+    }
+
+    uint32_t divisor = PIT_BASE_FREQUENCY / frequency;
+    if (divisor > PIT_MAX_COUNT)
+    {
+        return EINVARG;
+    }
+
+    pit_divisor = divisor;
+    pit_frequency = PIT_BASE_FREQUENCY / divisor;
+    pit_tick_handler = tick_handler;
+
+    pit_set_periodic();
+    register_interrupt_handler(IRQ0, pit_irq);
+
+    return EOK;
+}
+
+void pit_set_periodic(void)
+{
+    pit_oneshot = false;
+    pit_count = 0;
+    pit_carry = 0;
+    pit_program(PIT_MODE_RATE_GENERATOR, pit_divisor);
+}
+
+// raises a single interrupt the given number of periods after the last tick,
+// clamped to what the counter can hold. returns the number of periods actually
+// programmed. the counter stays below PIT_MAX_COUNT so a wrapped count is seen
+uint32_t pit_set_oneshot(uint32_t ticks)
+{
+    uint32_t max_ticks = (PIT_MAX_COUNT - 1) / pit_divisor;
+    if (ticks > max_ticks)
+    {
+        ticks = max_ticks;
+    }
+    else if (ticks == 0)
+    {
+        ticks = 1;
+    }
+
+    uint32_t elapsed = pit_elapsed();
+    uint32_t count = ticks * pit_divisor;
+    count = elapsed + PIT_MIN_COUNT < count ? count - elapsed : PIT_MIN_COUNT;
+
+    pit_oneshot = true;
+    pit_carry = elapsed;
+    pit_count = count;
+    pit_program(PIT_MODE_TERMINAL_COUNT, count);
+
+    return ticks;
+}
+
+uint32_t pit_get_frequency(void)
+{
+    return pit_frequency;
+}
+
+uint32_t pit_get_ticks(void)
+{
+    return pit_ticks;
+}
+
+// periods that started since the last tick, counting the one in progress
+uint32_t pit_get_pending_ticks(void)
+{
+    if (pit_divisor == 0)
+    {
+        return 0;
+    }
+
+    uint32_t flags = interrupts_save();
+    uint32_t elapsed = pit_elapsed();
+    interrupts_restore(flags);
+
+    return (elapsed + pit_divisor - 1) / pit_divisor;
+}
+
+// busy waits count input clock cycles on channel 2. it only drives the
+// speaker, so the timer interrupt on channel 0 is not disturbed
+void pit_wait(uint32_t count)
+{
+    if (count == 0 || count > PIT_MAX_COUNT)
+    {
+        return;
+    }
+
+    uint8_t control = port_byte_in(PIT_SPEAKER_CONTROL);
+    port_byte_out(PIT_SPEAKER_CONTROL, (control & ~PIT_SPEAKER_DATA) | PIT_SPEAKER_GATE);
+
+    port_byte_out(PIT_COMMAND, PIT_CHANNEL2 | PIT_ACCESS_LOW_HIGH | PIT_MODE_TERMINAL_COUNT);
+    port_byte_out(PIT_CHANNEL2_DATA, count & 0xFF);
+    port_byte_out(PIT_CHANNEL2_DATA, (count >> 8) & 0xFF);
+
+    while (!(port_byte_in(PIT_SPEAKER_CONTROL) & PIT_CHANNEL2_OUT))
+        ;
+
+    port_byte_out(PIT_SPEAKER_CONTROL, control);
+}
@@ -1,5 +1,8 @@
 #include <kernel/dev/tty/ega.h>
 #include <kernel/lib/string.h>
+#include <kernel/memory_layout.h>
+
+#define EGA_TEXT_BUFFER PHYS_TO_VIRT(0xB8000)
 
 uint32_t ega_driver_init(char_device_t *cdev, struct multiboot_tag_framebuffer *framebuffer)
 {
@@ -27,7 +30,7 @@ uint32_t ega_driver_get_height(char_device_t *cdev)
 uint32_t ega_driver_write_tty(char_device_t *cdev, uint32_t x, uint32_t y, uint8_t color, const char c)
 {
     // TODO: Check if x or y are out of range
-    uint8_t *vidmem = (uint8_t *)0xB8000;
+    uint8_t *vidmem = EGA_TEXT_BUFFER;
     uint32_t offset = 2 * (y * ega_driver_get_width(cdev) + x);
 
     vidmem[offset] = c;
@@ -38,7 +41,7 @@ uint32_t ega_driver_write_tty(char_device_t *cdev, uint32_t x, uint32_t y, uint8
 
 uint32_t ega_driver_scroll_line(char_device_t *cdev)
 {
-    uint16_t *screen_buffer = (uint16_t *)0xB8000;
+    uint16_t *screen_buffer = EGA_TEXT_BUFFER;
 
     for (uint32_t i = 0; i < ega_driver_get_height(cdev) - 1; ++i)
     {
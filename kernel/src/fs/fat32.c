@@ -2,6 +2,7 @@
 #include <kernel/lib/string.h>
 #include <kernel/lib/ascii.h>
 #include <kernel/heap.h>
+#include <kernel/slab.h>
 #include <kernel/dev/block_device.h>
 
 #define BACKUP_SECTOR_NUM 6
@@ -98,6 +99,38 @@ struct lfn_directory_entry
     uint16_t name3[2];
 } __attribute__((packed));
 
+// per node data, the first cluster is found once when the node is opened and
+// the chain of a file is read into clusters on its first read, so reads at any
+// offset (page faults on a mapped image) go straight to their cluster
+struct fat32_node
+{
+    struct boot_sector *boot_sector;
+    uint32_t first_cluster;
+    uint32_t *clusters;
+    uint32_t num_clusters;
+};
+
+static kmem_cache_t *directory_entry_cache = NULL;
+
+static struct directory_entry *alloc_directory_entry(void)
+{
+    if (directory_entry_cache == NULL)
+    {
+        directory_entry_cache = kmem_cache_create("directory_entry", sizeof(struct directory_entry), NULL);
+        if (directory_entry_cache == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    return kmem_cache_alloc(directory_entry_cache);
+}
+
+static void free_directory_entry(struct directory_entry *direntry)
+{
+    kmem_cache_free(directory_entry_cache, direntry);
+}
+
 static void read_fat_device(logical_block_device_t *lbdev, uint32_t lba, uint32_t num_blocks, uint8_t *buf)
 {
     block_request_t request = {};
@@ -231,10 +264,31 @@ struct boot_sector *scan_fat(uint32_t bytes_per_sector, logical_block_device_t *
     return boot_sector;
 }
 
+static struct fat32_node *alloc_fat32_node(struct boot_sector *boot_sector, uint32_t first_cluster)
+{
+    struct fat32_node *fat_node = kmalloc(sizeof(struct fat32_node));
+    if (fat_node != NULL)
+    {
+        fat_node->boot_sector = boot_sector;
+        fat_node->first_cluster = first_cluster;
+        fat_node->clusters = NULL;
+        fat_node->num_clusters = 0;
+    }
+
+    return fat_node;
+}
+
+static struct boot_sector *boot_sector_from_node(fs_node_t *node)
+{
+    return ((struct fat32_node *)node->fs_private_data)->boot_sector;
+}
+
 void free_fat()
 {
-    kfree(fs_root->fs_private_data);
-    kfree(fs_root);
+    struct fat32_node *fat_node = (struct fat32_node *)fs_root->fs_private_data;
+    kfree(fat_node->boot_sector);
+    kfree(fat_node);
+    free_fs_node(fs_root);
 }
 
 static char *fat32_nameext_to_name(const char *nameext, char *filename)
@@ -332,12 +386,13 @@ static uint32_t read_fat_entry(uint32_t cluster_num, struct boot_sector *boot_se
 {
     uint32_t fat_index = cluster_num * sizeof(uint32_t);
     uint32_t lba_offset = fat_index % boot_sector->bpb.byter_per_sector;
-    uint32_t lba = boot_sector->bpb.reserved_sector_count + fat_index - lba_offset;
+    uint32_t lba = boot_sector->bpb.reserved_sector_count + fat_index / boot_sector->bpb.byter_per_sector;
 
     uint8_t *fat_section = kmalloc(boot_sector->bpb.byter_per_sector);
     read_fat_device(lbdev, lba, 1, fat_section);
 
-    uint32_t fat_entry = fat_section[lba_offset];
+    // the upper four bits are reserved
+    uint32_t fat_entry = *(uint32_t *)(fat_section + lba_offset) & 0x0FFFFFFF;
 
     kfree(fat_section);
     return fat_entry;
@@ -402,8 +457,11 @@ static struct directory_entry *find_entry_by_name(const char *name, uint32_t dir
 
             if (strncmp(filename, name, 11) == 0)
             {
-                struct directory_entry *res = kmalloc(sizeof(struct directory_entry));
-                memcpy(res, &direntries[i], sizeof(struct directory_entry));
+                struct directory_entry *res = alloc_directory_entry();
+                if (res != NULL)
+                {
+                    memcpy(res, &direntries[i], sizeof(struct directory_entry));
+                }
                 kfree(cluster_buf);
                 return res;
             }
@@ -477,8 +535,11 @@ static struct directory_entry *find_entry_by_index(uint32_t index, uint32_t dire
                     fat32_nameext_to_name(direntries[i].nameext, filename);
                 }
 
-                struct directory_entry *res = kmalloc(sizeof(struct directory_entry));
-                memcpy(res, &direntries[i], sizeof(struct directory_entry));
+                struct directory_entry *res = alloc_directory_entry();
+                if (res != NULL)
+                {
+                    memcpy(res, &direntries[i], sizeof(struct directory_entry));
+                }
                 kfree(cluster_buf);
                 return res;
             }
@@ -512,7 +573,7 @@ static struct directory_entry *direntry_from_path(const char *path, struct boot_
         pch = strtok(NULL, "/");
         if (pch != NULL)
         {
-            kfree(direntry);
+            free_directory_entry(direntry);
         }
     }
     kfree(path_cpy);
@@ -525,68 +586,69 @@ static uint32_t first_cluster_from_direntry(struct directory_entry *direntry)
     return (((uint32_t)direntry->first_cluster_hi) << 16) | ((uint32_t)direntry->first_cluster_low);
 }
 
-static uint32_t first_cluster_from_path(const char *path, struct boot_sector *boot_sector, logical_block_device_t *lbdev)
+static uint32_t fat32_load_clusters(fs_node_t *node)
 {
-    if (strcmp(path, "/") == 0) // TODO: find a more 'bulletproof' way to check (ignore whitespace, ...)
+    struct fat32_node *fat_node = (struct fat32_node *)node->fs_private_data;
+    uint32_t bytes_per_cluster = fat_node->boot_sector->bpb.sectors_per_cluster * fat_node->boot_sector->bpb.byter_per_sector;
+    uint32_t num_clusters = ROUND_UP_INT_DIV(node->filesize, bytes_per_cluster);
+
+    uint32_t *clusters = kmalloc(num_clusters * sizeof(uint32_t));
+    if (clusters == NULL)
     {
-        return boot_sector->bpb.FAT32.root_cluster;
+        return ENOMEM;
     }
 
-    struct directory_entry *direntry = direntry_from_path(path, boot_sector, lbdev);
-    if (!direntry)
+    uint32_t current_cluster = fat_node->first_cluster;
+    uint32_t i = 0;
+    for (; i < num_clusters && current_cluster < 0x0FFFFFF8; i++)
     {
-        return -1;
+        clusters[i] = current_cluster;
+        current_cluster = read_fat_entry(current_cluster, fat_node->boot_sector, node->lbdev);
     }
 
-    return first_cluster_from_direntry(direntry);
+    // reading the chain sleeps on the disk, another reader may have finished first
+    if (fat_node->clusters != NULL)
+    {
+        kfree(clusters);
+        return EOK;
+    }
+
+    fat_node->clusters = clusters;
+    fat_node->num_clusters = i;
+    return EOK;
 }
 
 uint32_t read_fat32(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
-    struct boot_sector *boot_sector = (struct boot_sector *)node->fs_private_data;
+    struct boot_sector *boot_sector = boot_sector_from_node(node);
     logical_block_device_t *lbdev = node->lbdev;
 
-    uint32_t current_cluster = first_cluster_from_path(node->path, boot_sector, lbdev);
+    struct fat32_node *fat_node = (struct fat32_node *)node->fs_private_data;
+    if (fat_node->clusters == NULL && node->filesize > 0)
+    {
+        uint32_t res = fat32_load_clusters(node);
+        if (res != EOK)
+        {
+            return res;
+        }
+    }
+
     uint32_t bytes_per_cluster = boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.byter_per_sector;
-    uint8_t *cluster_buf = kmalloc(bytes_per_cluster);
+    uint32_t cluster_index = offset / bytes_per_cluster;
+    uint32_t cluster_offset = offset % bytes_per_cluster;
 
-    uint32_t current_cluster_num = 0;
+    uint8_t *cluster_buf = kmalloc(bytes_per_cluster);
     uint32_t buffer_index = 0;
 
-    while (current_cluster < 0x0FFFFFF8)
+    while (buffer_index < size && cluster_index < fat_node->num_clusters)
     {
-        uint32_t byte_offset = current_cluster_num * bytes_per_cluster;
-        if (offset >= byte_offset && offset < (byte_offset + bytes_per_cluster))
-        {
-            read_cluster(current_cluster, cluster_buf, boot_sector, lbdev);
-            uint32_t cluster_offset = offset - byte_offset;
-            uint32_t cpy_size = (size > (bytes_per_cluster - cluster_offset)) ? (bytes_per_cluster - cluster_offset) : size;
-
-            memcpy((void *)((uintptr_t)buffer + buffer_index), (void *)((uintptr_t)cluster_buf + cluster_offset), cpy_size);
-            buffer_index += cpy_size;
-
-            if (buffer_index == size)
-            {
-                kfree(cluster_buf);
-                return 0;
-            }
-        }
-        else if (offset < byte_offset && (offset + size) >= (byte_offset + bytes_per_cluster))
-        {
-            read_cluster(current_cluster, cluster_buf, boot_sector, lbdev);
-            memcpy((void *)((uintptr_t)buffer + buffer_index), (void *)((uintptr_t)cluster_buf), bytes_per_cluster);
-            buffer_index += bytes_per_cluster;
-        }
-        else if ((offset + size) >= byte_offset && (offset + size) < (byte_offset + bytes_per_cluster))
-        {
-            read_cluster(current_cluster, cluster_buf, boot_sector, lbdev);
-            memcpy((void *)((uintptr_t)buffer + buffer_index), cluster_buf, size - buffer_index);
-            kfree(cluster_buf);
-            return 0;
-        }
+        read_cluster(fat_node->clusters[cluster_index], cluster_buf, boot_sector, lbdev);
+        uint32_t cpy_size = (size - buffer_index > bytes_per_cluster - cluster_offset) ? (bytes_per_cluster - cluster_offset) : (size - buffer_index);
 
-        current_cluster = read_fat_entry(current_cluster, boot_sector, lbdev);
-        current_cluster_num++;
+        memcpy((void *)((uintptr_t)buffer + buffer_index), (void *)((uintptr_t)cluster_buf + cluster_offset), cpy_size);
+        buffer_index += cpy_size;
+        cluster_offset = 0;
+        cluster_index++;
     }
 
     kfree(cluster_buf);
@@ -609,7 +671,8 @@ fs_node_t *finddir_fat32(fs_node_t *node, const char *name);
 
 fs_node_t *open_fat32(const char *path)
 {
-    struct directory_entry *direntry = direntry_from_path(path, (struct boot_sector *)fs_root->fs_private_data, fs_root->lbdev);
+    struct boot_sector *boot_sector = boot_sector_from_node(fs_root);
+    struct directory_entry *direntry = direntry_from_path(path, boot_sector, fs_root->lbdev);
     if (direntry == 0)
     {
         return NULL;
@@ -621,8 +684,12 @@ fs_node_t *open_fat32(const char *path)
 
     bool is_dir = (direntry->attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
 
-    fs_node_t *fs_node = kmalloc(sizeof(fs_node_t));
-    memset(fs_node, 0x00, sizeof(fs_node_t));
+    fs_node_t *fs_node = alloc_fs_node();
+    if (fs_node == NULL)
+    {
+        free_directory_entry(direntry);
+        return NULL;
+    }
     strcpy(fs_node->path, path);
 
     if (is_dir)
@@ -639,7 +706,13 @@ fs_node_t *open_fat32(const char *path)
     fs_node->close = &close_fat32;
 
     fs_node->lbdev = fs_root->lbdev;
-    fs_node->fs_private_data = fs_root->fs_private_data;
+    fs_node->fs_private_data = alloc_fat32_node(boot_sector, first_cluster_from_direntry(direntry));
+    if (fs_node->fs_private_data == NULL)
+    {
+        free_directory_entry(direntry);
+        free_fs_node(fs_node);
+        return NULL;
+    }
 
     fs_node->creation_time = direntry->creation_time;
     fs_node->creation_date = direntry->creation_date;
@@ -683,7 +756,13 @@ void close_fat32(fs_node_t *node)
 {
     if (node != fs_root)
     {
-        kfree(node);
+        struct fat32_node *fat_node = (struct fat32_node *)node->fs_private_data;
+        if (fat_node->clusters != NULL)
+        {
+            kfree(fat_node->clusters);
+        }
+        kfree(fat_node);
+        free_fs_node(node);
     }
 }
 
@@ -691,14 +770,10 @@ struct dirent dirent_fat32;
 
 struct dirent *readdir_fat32(fs_node_t *node, uint32_t index)
 {
-    struct boot_sector *boot_sector = (struct boot_sector *)node->fs_private_data;
+    struct boot_sector *boot_sector = boot_sector_from_node(node);
     logical_block_device_t *lbdev = node->lbdev;
 
-    uint32_t cluster = first_cluster_from_path(node->path, boot_sector, lbdev);
-    if (cluster == (uint32_t)-1)
-    {
-        return NULL;
-    }
+    uint32_t cluster = ((struct fat32_node *)node->fs_private_data)->first_cluster;
 
     char filename[256];
     struct directory_entry *direntry = find_entry_by_index(index, cluster, filename, boot_sector, lbdev);
@@ -707,7 +782,7 @@ struct dirent *readdir_fat32(fs_node_t *node, uint32_t index)
         return NULL;
     }
 
-    kfree(direntry);
+    free_directory_entry(direntry);
 
     memset(&dirent_fat32, 0, sizeof(struct dirent));
     strcpy(dirent_fat32.name, filename);
@@ -716,7 +791,7 @@ struct dirent *readdir_fat32(fs_node_t *node, uint32_t index)
 
 fs_node_t *finddir_fat32(fs_node_t *node, const char *name)
 {
-    struct boot_sector *boot_sector = (struct boot_sector *)node->fs_private_data;
+    struct boot_sector *boot_sector = boot_sector_from_node(node);
     logical_block_device_t *lbdev = node->lbdev;
 
     char full_path[128];
@@ -743,8 +818,15 @@ fs_node_t *finddir_fat32(fs_node_t *node, const char *name)
         is_dir = true;
     }
 
-    fs_node_t *fs_node = kmalloc(sizeof(fs_node_t)); // remember to call close_fs on the fs_node_t *
-    memset(fs_node, 0x00, sizeof(fs_node_t));
+    fs_node_t *fs_node = alloc_fs_node(); // remember to call close_fs on the fs_node_t *
+    if (fs_node == NULL)
+    {
+        if ((uintptr_t)direntry != 1)
+        {
+            free_directory_entry(direntry);
+        }
+        return NULL;
+    }
     strcpy(fs_node->path, full_path);
 
     if (is_dir)
@@ -761,7 +843,17 @@ fs_node_t *finddir_fat32(fs_node_t *node, const char *name)
     fs_node->close = &close_fat32;
 
     fs_node->lbdev = lbdev;
-    fs_node->fs_private_data = (void *)boot_sector;
+    uint32_t first_cluster = ((uintptr_t)direntry == 1) ? boot_sector->bpb.FAT32.root_cluster : first_cluster_from_direntry(direntry);
+    fs_node->fs_private_data = alloc_fat32_node(boot_sector, first_cluster);
+    if (fs_node->fs_private_data == NULL)
+    {
+        if ((uintptr_t)direntry != 1)
+        {
+            free_directory_entry(direntry);
+        }
+        free_fs_node(fs_node);
+        return NULL;
+    }
 
     fs_node->creation_time = direntry->creation_time;
     fs_node->creation_date = direntry->creation_date;
@@ -803,8 +895,11 @@ fs_node_t *finddir_fat32(fs_node_t *node, const char *name)
 
 fs_node_t *initialise_fat32(logical_block_device_t *lbdev)
 {
-    fs_node_t *root_node = kmalloc(sizeof(fs_node_t));
-    memset(root_node, 0x00, sizeof(fs_node_t));
+    fs_node_t *root_node = alloc_fs_node();
+    if (root_node == NULL)
+    {
+        return NULL;
+    }
     strcpy(root_node->path, "/");
     root_node->flags = FS_DIRECTORY;
     root_node->readdir = &readdir_fat32;
@@ -812,7 +907,14 @@ fs_node_t *initialise_fat32(logical_block_device_t *lbdev)
     root_node->open = &open_fat32;
     root_node->close = &close_fat32;
     root_node->lbdev = lbdev;
-    root_node->fs_private_data = (void *)scan_fat(lbdev->parent->block_size, lbdev);
+    struct boot_sector *boot_sector = scan_fat(lbdev->parent->block_size, lbdev);
+    root_node->fs_private_data = alloc_fat32_node(boot_sector, boot_sector->bpb.FAT32.root_cluster);
+    if (root_node->fs_private_data == NULL)
+    {
+        kfree(boot_sector);
+        free_fs_node(root_node);
+        return NULL;
+    }
 
     return root_node;
 }
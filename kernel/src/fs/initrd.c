@@ -110,7 +110,11 @@ static fs_node_t *initrd_finddir(fs_node_t *node, const char *name)
 
         if (!strncmp(initrd_header->file_table[i].filename, name, 10))
         {
-            fs_node_t *node = kmalloc(sizeof(fs_node_t));
+            fs_node_t *node = alloc_fs_node();
+            if (node == NULL)
+            {
+                return NULL;
+            }
             strcpy(node->path, initrd_header->file_table[i].filename);
             node->mask = 0;
             node->flags = FS_FILE;
@@ -131,7 +135,11 @@ static fs_node_t *initrd_finddir(fs_node_t *node, const char *name)
 fs_node_t *initialise_initrd(uint32_t location)
 {
     initrd_header = (initrd_header_t *)location;
-    initrd_root = (fs_node_t *)kmalloc(sizeof(fs_node_t));
+    initrd_root = alloc_fs_node();
+    if (initrd_root == NULL)
+    {
+        return NULL;
+    }
     strcpy(initrd_root->path, "initrd");
     initrd_root->mask = 0;
     initrd_root->flags = FS_DIRECTORY;
@@ -142,7 +150,13 @@ fs_node_t *initialise_initrd(uint32_t location)
     initrd_root->finddir = &initrd_finddir;
 
     // Initialise the /dev directory (required!)
-    initrd_dev = (fs_node_t *)kmalloc(sizeof(fs_node_t));
+    initrd_dev = alloc_fs_node();
+    if (initrd_dev == NULL)
+    {
+        free_fs_node(initrd_root);
+        initrd_root = NULL;
+        return NULL;
+    }
     strcpy(initrd_dev->path, "dev");
     initrd_dev->mask = 0;
     initrd_dev->flags = FS_DIRECTORY;
@@ -157,6 +171,6 @@ fs_node_t *initialise_initrd(uint32_t location)
 
 void free_initrd()
 {
-    kfree(initrd_root);
-    kfree(initrd_dev);
+    free_fs_node(initrd_root);
+    free_fs_node(initrd_dev);
 }
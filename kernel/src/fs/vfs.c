@@ -1,7 +1,35 @@
 #include <kernel/fs/vfs.h>
+#include <kernel/slab.h>
+#include <kernel/lib/string.h>
 
 fs_node_t *fs_root = 0;
 
+static kmem_cache_t *fs_node_cache = 0;
+
+fs_node_t *alloc_fs_node(void)
+{
+    if (fs_node_cache == 0)
+    {
+        fs_node_cache = kmem_cache_create("fs_node_t", sizeof(fs_node_t), 0);
+        if (fs_node_cache == 0)
+            return 0;
+    }
+
+    fs_node_t *node = kmem_cache_alloc(fs_node_cache);
+    if (node != 0)
+    {
+        memset(node, 0, sizeof(fs_node_t));
+        node->refcount = 1;
+    }
+
+    return node;
+}
+
+void free_fs_node(fs_node_t *node)
+{
+    kmem_cache_free(fs_node_cache, node);
+}
+
 uint32_t read_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
     if (node->read != 0)
@@ -26,8 +54,21 @@ fs_node_t *open_fs(const char *path)
         return 0;
 }
 
+// another reference to an open node, each one is given up with close_fs
+fs_node_t *dup_fs(fs_node_t *node)
+{
+    node->refcount++;
+    return node;
+}
+
 void close_fs(fs_node_t *node)
 {
+    if (node->refcount > 1)
+    {
+        node->refcount--;
+        return;
+    }
+
     if (node->close != 0)
         return node->close(node);
 
@@ -0,0 +1,22 @@
+#include <kernel/lib/math.h>
+
+uint64_t div_u64(uint64_t dividend, uint32_t divisor, uint32_t *remainder)
+{
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+
+    // divide the high word first, its remainder is below the divisor so the
+    // second divl can not overflow
+    uint32_t quotient_high = high / divisor;
+    uint32_t rest = high % divisor;
+
+    uint32_t quotient_low;
+    __asm__("divl %4" : "=a"(quotient_low), "=d"(rest) : "a"(low), "d"(rest), "rm"(divisor));
+
+    if (remainder)
+    {
+        *remainder = rest;
+    }
+
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
@@ -1,13 +1,39 @@
 #include <kernel/page_allocator.h>
+#include <kernel/memory_layout.h>
 #include <kernel/tty.h>
 #include <kernel/lib/string.h>
 #include <kernel/lib/cast.h>
 
+#define PAGE_FRAME_NONE 0xFFFFFFFF
+
+#define PAGE_FRAME_FREE 0x01      // frame is the first frame of a block on a free list
+#define PAGE_FRAME_ALLOCATED 0x02 // frame is the first frame of an allocated block
+
+typedef struct
+{
+  // free list links (frame indices), only valid while PAGE_FRAME_FREE is set
+  uint32_t next;
+  uint32_t prev;
+  uint8_t order;
+  uint8_t flags;
+  uint16_t refcount; // owners of an allocated block, it is freed when the last one lets go
+} page_frame_t;
+
 struct page_allocator_info
 {
+  page_frame_t *frames;
+
+  // bit n is set when page n is in use, one summary bit per completely used bitmap word
+  // and one top bit per completely used summary word (1024 pages)
   uint32_t *bitmap;
+  uint32_t *summary;
+  uint32_t *top;
+  uint32_t num_words;
+
   uint32_t num_pages;
-  uint32_t last_index;
+  uint32_t num_free_pages;
+  uint32_t free_lists[PAGE_ALLOC_MAX_ORDER + 1];
+  uint32_t free_orders; // bit n is set when free_lists[n] is not empty
 } page_allocator;
 
 static void bit_set(uint32_t *bitmap, uint32_t index)
@@ -31,6 +57,252 @@ static bool bit_get(const uint32_t *bitmap, uint32_t index)
   return (bitmap[array_index] & (1UL << bit_offset)) != 0;
 }
 
+static void bitmap_update_summary(uint32_t word)
+{
+  if (page_allocator.bitmap[word] == 0xFFFFFFFF)
+    bit_set(page_allocator.summary, word);
+  else
+    bit_clear(page_allocator.summary, word);
+
+  if (page_allocator.summary[word / 32] == 0xFFFFFFFF)
+    bit_set(page_allocator.top, word / 32);
+  else
+    bit_clear(page_allocator.top, word / 32);
+}
+
+static void bitmap_set_range(uint32_t start, uint32_t count, bool used)
+{
+  while (count > 0)
+  {
+    uint32_t word = start / 32;
+    uint32_t bit_offset = start % 32;
+    uint32_t bits = 32 - bit_offset;
+    if (bits > count)
+      bits = count;
+
+    uint32_t mask = (bits == 32) ? 0xFFFFFFFF : (((1UL << bits) - 1) << bit_offset);
+    if (used)
+      page_allocator.bitmap[word] |= mask;
+    else
+      page_allocator.bitmap[word] &= ~mask;
+
+    bitmap_update_summary(word);
+
+    start += bits;
+    count -= bits;
+  }
+}
+
+// returns the first page of a run of count free pages, skipping used words and
+// 1024 page groups through the summary levels
+static uint32_t bitmap_find_run(uint32_t count)
+{
+  uint32_t run_start = 0;
+  uint32_t run_length = 0;
+  uint32_t word = 0;
+
+  while (word < page_allocator.num_words)
+  {
+    if (bit_get(page_allocator.top, word / 32))
+    {
+      run_length = 0;
+      word = (word / 32 + 1) * 32;
+      continue;
+    }
+
+    uint32_t not_full = ~page_allocator.summary[word / 32] & (0xFFFFFFFF << (word % 32));
+    if (not_full == 0)
+    {
+      run_length = 0;
+      word = (word / 32 + 1) * 32;
+      continue;
+    }
+
+    uint32_t next_word = (word & ~31UL) + __builtin_ctz(not_full);
+    if (next_word != word)
+    {
+      run_length = 0;
+      word = next_word;
+      if (word >= page_allocator.num_words)
+        break;
+    }
+
+    uint32_t value = page_allocator.bitmap[word];
+    uint32_t bit = 0;
+    while (bit < 32)
+    {
+      uint32_t rest = value >> bit;
+      uint32_t free_bits = (rest == 0) ? 32 - bit : (uint32_t)__builtin_ctz(rest);
+
+      if (free_bits > 0)
+      {
+        if (run_length == 0)
+          run_start = word * 32 + bit;
+
+        run_length += free_bits;
+        if (run_length >= count)
+          return run_start;
+
+        bit += free_bits;
+        if (bit >= 32)
+          break;
+      }
+
+      run_length = 0;
+      bit += __builtin_ctz(~(value >> bit));
+    }
+
+    word++;
+  }
+
+  return PAGE_FRAME_NONE;
+}
+
+static void free_list_push(uint32_t index, uint32_t order)
+{
+  page_frame_t *frame = &page_allocator.frames[index];
+  frame->order = order;
+  frame->flags = PAGE_FRAME_FREE;
+  frame->prev = PAGE_FRAME_NONE;
+  frame->next = page_allocator.free_lists[order];
+
+  if (frame->next != PAGE_FRAME_NONE)
+    page_allocator.frames[frame->next].prev = index;
+
+  page_allocator.free_lists[order] = index;
+  page_allocator.free_orders |= (1UL << order);
+}
+
+static void free_list_remove(uint32_t index)
+{
+  page_frame_t *frame = &page_allocator.frames[index];
+
+  if (frame->prev != PAGE_FRAME_NONE)
+    page_allocator.frames[frame->prev].next = frame->next;
+  else
+    page_allocator.free_lists[frame->order] = frame->next;
+
+  if (frame->next != PAGE_FRAME_NONE)
+    page_allocator.frames[frame->next].prev = frame->prev;
+
+  if (page_allocator.free_lists[frame->order] == PAGE_FRAME_NONE)
+    page_allocator.free_orders &= ~(1UL << frame->order);
+
+  frame->flags = 0;
+}
+
+static void free_block(uint32_t index, uint32_t order)
+{
+  page_allocator.frames[index].flags = 0;
+  page_allocator.frames[index].refcount = 0;
+  page_allocator.num_free_pages += (1UL << order);
+  bitmap_set_range(index, 1UL << order, false);
+
+  // merge with the buddy as long as it is a free block of the same order
+  while (order < PAGE_ALLOC_MAX_ORDER)
+  {
+    uint32_t buddy = index ^ (1UL << order);
+    if (buddy >= page_allocator.num_pages)
+      break;
+
+    page_frame_t *buddy_frame = &page_allocator.frames[buddy];
+    if (!(buddy_frame->flags & PAGE_FRAME_FREE) || buddy_frame->order != order)
+      break;
+
+    free_list_remove(buddy);
+    index &= ~(1UL << order);
+    order++;
+  }
+
+  free_list_push(index, order);
+}
+
+static uint32_t alloc_block(uint32_t order)
+{
+  uint32_t available = page_allocator.free_orders & ~((1UL << order) - 1);
+  if (available == 0)
+    return PAGE_FRAME_NONE;
+
+  uint32_t current = __builtin_ctz(available);
+  uint32_t index = page_allocator.free_lists[current];
+  free_list_remove(index);
+
+  // hand the upper halves back until the block has the requested size
+  while (current > order)
+  {
+    current--;
+    free_list_push(index + (1UL << current), current);
+  }
+
+  page_allocator.frames[index].order = order;
+  page_allocator.frames[index].flags = PAGE_FRAME_ALLOCATED;
+  page_allocator.frames[index].refcount = 1;
+  page_allocator.num_free_pages -= (1UL << order);
+  bitmap_set_range(index, 1UL << order, true);
+
+  return index;
+}
+
+// allocates the smallest block holding count pages and hands back the pages
+// past count as whole upper buddies. the kept pages are split into aligned
+// blocks of their own so that page_free_contiguous can free them one by one
+static uint32_t alloc_range(uint32_t count)
+{
+  uint32_t order = 0;
+  while ((1UL << order) < count)
+    order++;
+
+  if (order > PAGE_ALLOC_MAX_ORDER)
+    return PAGE_FRAME_NONE;
+
+  uint32_t index = alloc_block(order);
+  if (index == PAGE_FRAME_NONE)
+    return PAGE_FRAME_NONE;
+
+  uint32_t offset = 0;
+  uint32_t current = order;
+  while (offset < count)
+  {
+    if (count & (1UL << current))
+    {
+      page_allocator.frames[index + offset].order = current;
+      page_allocator.frames[index + offset].flags = PAGE_FRAME_ALLOCATED;
+      page_allocator.frames[index + offset].refcount = 1;
+      offset += (1UL << current);
+    }
+
+    current--;
+  }
+
+  // the buddy of every trimmed block lies below it in the kept pages, so
+  // nothing can be merged and the bitmap is cleared in one go
+  uint32_t end = 1UL << order;
+  while (offset < end)
+  {
+    current = __builtin_ctz(offset);
+    free_list_push(index + offset, current);
+    offset += (1UL << current);
+  }
+
+  page_allocator.num_free_pages += end - count;
+  bitmap_set_range(index + count, end - count, false);
+
+  return index;
+}
+
+static void free_range(uint32_t start, uint32_t end)
+{
+  while (start < end)
+  {
+    uint32_t order = PAGE_ALLOC_MAX_ORDER;
+    while (order > 0 && ((start & ((1UL << order) - 1)) != 0 || start + (1UL << order) > end))
+      order--;
+
+    free_block(start, order);
+    start += (1UL << order);
+  }
+}
+
 uint32_t page_alloc_init(struct multiboot_tag_mmap *mmap, uint32_t mmap_size)
 {
   uint32_t res = EOK;
@@ -72,12 +344,24 @@ uint32_t page_alloc_init(struct multiboot_tag_mmap *mmap, uint32_t mmap_size)
       max_addr = end_addr;
   }
 
+  // only memory inside the kernel direct map can be handed out
+  if (max_addr > KERNEL_DIRECT_MAP_SIZE)
+    max_addr = KERNEL_DIRECT_MAP_SIZE;
+
   page_allocator.num_pages = max_addr / PAGE_SIZE;
-  uint32_t bitmap_size = (page_allocator.num_pages + 8 - 1) / 8;
-  kprintf("page allocator bitmap size 0x%x\n", bitmap_size);
+  page_allocator.num_words = (page_allocator.num_pages + 32 - 1) / 32;
+  uint32_t num_summary_words = (page_allocator.num_words + 32 - 1) / 32;
+  uint32_t num_top_words = (num_summary_words + 32 - 1) / 32;
 
-  page_allocator.bitmap = (uint32_t *)max_addr;
+  // the frame table and the bitmaps behind it are reserved as one block
+  uint32_t frames_size = page_allocator.num_pages * sizeof(page_frame_t);
+  uint32_t bitmap_size = (page_allocator.num_words + num_summary_words + num_top_words) * sizeof(uint32_t);
+  uint32_t metadata_size = (frames_size + bitmap_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  kprintf("page allocator metadata size 0x%x\n", metadata_size);
 
+  // the metadata goes to the top of the highest region that can hold it,
+  // away from the kernel image and the boot modules in low memory
+  uint32_t frames_addr = 0;
   for (struct multiboot_mmap_entry *entry = mmap->entries;
        (multiboot_uint8_t *)entry < (multiboot_uint8_t *)mmap + mmap_size;
        entry = (multiboot_memory_map_t *)((unsigned long)entry + mmap->entry_size))
@@ -85,24 +369,37 @@ uint32_t page_alloc_init(struct multiboot_tag_mmap *mmap, uint32_t mmap_size)
     if (entry->type != MULTIBOOT_MEMORY_AVAILABLE)
       continue;
 
-    if (entry->len < bitmap_size)
+    uint32_t end_addr = (uint32_t)(entry->addr + entry->len) & ~(PAGE_SIZE - 1);
+    if (end_addr > max_addr)
+      end_addr = max_addr;
+
+    if (end_addr < metadata_size || end_addr - metadata_size < entry->addr)
       continue;
 
-    page_allocator.bitmap = (uint32_t *)entry->addr;
-    entry->addr += bitmap_size;
-    entry->len -= bitmap_size;
-    break;
+    if (end_addr - metadata_size > frames_addr)
+      frames_addr = end_addr - metadata_size;
   }
 
-  if ((uint32_t)(page_allocator.bitmap) == max_addr)
+  if (frames_addr == 0)
   {
     res = ENOMEM;
     goto out;
   }
 
-  kprintf("page allocator bitmap located at 0x%x\n", (uint32_t)(page_allocator.bitmap));
+  page_allocator.frames = PHYS_TO_VIRT(frames_addr);
+  kprintf("page allocator frame table located at 0x%x\n", frames_addr);
+
+  page_allocator.bitmap = (uint32_t *)(page_allocator.frames + page_allocator.num_pages);
+  page_allocator.summary = page_allocator.bitmap + page_allocator.num_words;
+  page_allocator.top = page_allocator.summary + num_summary_words;
 
+  memset(page_allocator.frames, 0, frames_size);
   memset(page_allocator.bitmap, 0xFF, bitmap_size);
+  for (uint32_t i = 0; i <= PAGE_ALLOC_MAX_ORDER; i++)
+    page_allocator.free_lists[i] = PAGE_FRAME_NONE;
+
+  uint32_t frames_start_page = frames_addr / PAGE_SIZE;
+  uint32_t frames_end_page = (frames_addr + metadata_size) / PAGE_SIZE;
 
   for (struct multiboot_mmap_entry *entry = mmap->entries;
        (multiboot_uint8_t *)entry < (multiboot_uint8_t *)mmap + mmap_size;
@@ -112,40 +409,114 @@ uint32_t page_alloc_init(struct multiboot_tag_mmap *mmap, uint32_t mmap_size)
       continue;
 
     uint32_t start_page = (entry->addr + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t end_page = (entry->addr + entry->len) / PAGE_SIZE;
+
+    // page 0 stays reserved so that a physical address of 0 is never handed out
+    if (start_page == 0)
+      start_page = 1;
+
+    if (end_page > page_allocator.num_pages)
+      end_page = page_allocator.num_pages;
 
-    for (uint32_t j = 0; j < entry->len / PAGE_SIZE; j++)
+    if (start_page < frames_end_page && end_page > frames_start_page)
     {
-      uint32_t page_index = start_page + j;
-      bit_clear(page_allocator.bitmap, page_index);
+      free_range(start_page, frames_start_page);
+      start_page = frames_end_page;
     }
+
+    free_range(start_page, end_page);
   }
 
+  kprintf("page allocator has 0x%x free pages\n", page_allocator.num_free_pages);
+
 out:
   return res;
 }
 
+void *page_alloc_order(uint32_t order)
+{
+  if (order > PAGE_ALLOC_MAX_ORDER)
+    return NULL;
+
+  uint32_t index = alloc_block(order);
+  if (index == PAGE_FRAME_NONE)
+    return NULL;
+
+  return (void *)(index * PAGE_SIZE);
+}
+
+void *page_alloc_contiguous(uint32_t count)
+{
+  if (count == 0)
+    return NULL;
+
+  uint32_t index = alloc_range(count);
+  if (index != PAGE_FRAME_NONE)
+    return (void *)(index * PAGE_SIZE);
+
+  // runs larger than the biggest block, or free memory too fragmented for
+  // one, are found in the bitmap and reserved page by page
+  uint32_t start = bitmap_find_run(count);
+  if (start == PAGE_FRAME_NONE)
+    return NULL;
+
+  for (uint32_t i = 0; i < count; i++)
+    page_reserve((void *)((start + i) * PAGE_SIZE));
+
+  return (void *)(start * PAGE_SIZE);
+}
+
 void *page_alloc(void)
 {
-  for (uint32_t i = page_allocator.last_index; i < page_allocator.num_pages; i++)
+  uint32_t index = alloc_block(0);
+  if (index == PAGE_FRAME_NONE)
   {
-    if (bit_get(page_allocator.bitmap, i))
-      continue;
+    PANIC_PRINT("out of free pages");
+    return NULL;
+  }
 
-    bit_set(page_allocator.bitmap, i);
-    page_allocator.last_index = i;
+  return (void *)(index * PAGE_SIZE);
+}
+
+void page_free(void *ptr)
+{
+  uint32_t index = (uint32_t)ptr / PAGE_SIZE;
+  if (index >= page_allocator.num_pages || !(page_allocator.frames[index].flags & PAGE_FRAME_ALLOCATED))
+    return;
 
-    return (void *)(i * PAGE_SIZE);
+  if (page_allocator.frames[index].refcount > 1)
+  {
+    page_allocator.frames[index].refcount--;
+    return;
   }
 
-  PANIC_PRINT("out of free pages");
-  return NULL;
+  free_block(index, page_allocator.frames[index].order);
 }
 
-void page_free(void *ptr)
+void page_ref(void *ptr)
 {
   uint32_t index = (uint32_t)ptr / PAGE_SIZE;
-  bit_clear(page_allocator.bitmap, index);
-  page_allocator.last_index = index;
+  if (index >= page_allocator.num_pages || !(page_allocator.frames[index].flags & PAGE_FRAME_ALLOCATED))
+    return;
+
+  page_allocator.frames[index].refcount++;
+}
+
+uint32_t page_get_refcount(void *ptr)
+{
+  uint32_t index = (uint32_t)ptr / PAGE_SIZE;
+  if (index >= page_allocator.num_pages || !(page_allocator.frames[index].flags & PAGE_FRAME_ALLOCATED))
+    return 0;
+
+  return page_allocator.frames[index].refcount;
+}
+
+void page_free_contiguous(void *ptr, uint32_t count)
+{
+  // pages that are not the start of an allocated block (the inner pages of the
+  // blocks alloc_range splits the range into) are skipped by page_free
+  for (uint32_t i = 0; i < count; i++)
+    page_free((void *)((uint32_t)ptr + i * PAGE_SIZE));
 }
 
 uint32_t get_num_pages()
@@ -153,9 +524,52 @@ uint32_t get_num_pages()
   return page_allocator.num_pages;
 }
 
+uint32_t get_num_free_pages()
+{
+  return page_allocator.num_free_pages;
+}
+
 void page_reserve(void *ptr)
 {
   uint32_t index = (uint32_t)ptr / PAGE_SIZE;
+  if (index >= page_allocator.num_pages || bit_get(page_allocator.bitmap, index))
+    return; // already in use
+
+  // find the free block containing the page
+  uint32_t order = 0;
+  uint32_t head = index;
+  for (; order <= PAGE_ALLOC_MAX_ORDER; order++)
+  {
+    head = index & ~((1UL << order) - 1);
+    if ((page_allocator.frames[head].flags & PAGE_FRAME_FREE) && page_allocator.frames[head].order == order)
+      break;
+  }
+
+  if (order > PAGE_ALLOC_MAX_ORDER)
+    return;
+
+  free_list_remove(head);
+
+  // split the block, keeping the half that contains the page
+  while (order > 0)
+  {
+    order--;
+    uint32_t half = head + (1UL << order);
+    if (index >= half)
+    {
+      free_list_push(head, order);
+      head = half;
+    }
+    else
+    {
+      free_list_push(half, order);
+    }
+  }
+
+  page_allocator.frames[index].order = 0;
+  page_allocator.frames[index].flags = PAGE_FRAME_ALLOCATED;
+  page_allocator.frames[index].refcount = 1;
+  page_allocator.num_free_pages--;
   bit_set(page_allocator.bitmap, index);
-  page_allocator.last_index = index;
+  bitmap_update_summary(index / 32);
 }
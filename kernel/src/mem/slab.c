@@ -0,0 +1,226 @@
+#include <kernel/slab.h>
+#include <kernel/heap.h>
+#include <kernel/lib/string.h>
+
+// slabs are aligned to KMEM_CACHE_SLAB_SIZE and the first object always starts
+// inside the first slab sized block, so an object finds its slab by masking
+typedef struct kmem_slab
+{
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    void *free_list;
+    uint32_t num_active;
+} kmem_slab_t;
+
+static kmem_cache_t *caches = NULL;
+
+#define OBJECT_LINK(cache, object) (*(void **)((uintptr_t)(object) + (cache)->link_offset))
+#define OBJECT_SLAB(object) ((kmem_slab_t *)((uintptr_t)(object) & ~(KMEM_CACHE_SLAB_SIZE - 1)))
+
+static void kmem_slab_list_add(kmem_slab_t **list, kmem_slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void kmem_slab_list_remove(kmem_slab_t **list, kmem_slab_t *slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void kmem_slab_list_free(kmem_slab_t *slab)
+{
+    while (slab != NULL)
+    {
+        kmem_slab_t *next = slab->next;
+        kfree(slab);
+        slab = next;
+    }
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size, kmem_cache_ctor_t ctor)
+{
+    if (object_size == 0)
+    {
+        return NULL;
+    }
+
+    kmem_cache_t *cache = kmalloc(sizeof(kmem_cache_t));
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    strncpy(cache->name, name, KMEM_CACHE_NAME_LENGTH - 1);
+    cache->name[KMEM_CACHE_NAME_LENGTH - 1] = '\0';
+
+    cache->object_size = object_size;
+    cache->ctor = ctor;
+
+    // objects of a cache with a constructor stay constructed while they sit on
+    // the free list, so the link can not overlap them
+    uint32_t slot_size = (object_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (ctor)
+    {
+        cache->link_offset = slot_size;
+        slot_size += sizeof(void *);
+    }
+    else
+    {
+        cache->link_offset = 0;
+    }
+    cache->slot_size = slot_size;
+
+    cache->objects_per_slab = (KMEM_CACHE_SLAB_SIZE - sizeof(kmem_slab_t)) / slot_size;
+    if (cache->objects_per_slab == 0)
+    {
+        cache->objects_per_slab = 1;
+    }
+
+    cache->next = caches;
+    caches = cache;
+
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache)
+{
+    kmem_slab_list_free(cache->partial);
+    kmem_slab_list_free(cache->full);
+
+    if (caches == cache)
+    {
+        caches = cache->next;
+    }
+    else
+    {
+        for (kmem_cache_t *current = caches; current != NULL; current = current->next)
+        {
+            if (current->next == cache)
+            {
+                current->next = cache->next;
+                break;
+            }
+        }
+    }
+
+    kfree(cache);
+}
+
+static kmem_slab_t *kmem_cache_grow(kmem_cache_t *cache)
+{
+    kmem_slab_t *slab = kmalloc_aligned(KMEM_CACHE_SLAB_SIZE, sizeof(kmem_slab_t) + cache->objects_per_slab * cache->slot_size);
+    if (!slab)
+    {
+        return NULL;
+    }
+
+    uintptr_t object = (uintptr_t)slab + sizeof(kmem_slab_t);
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++)
+    {
+        if (cache->ctor)
+        {
+            cache->ctor((void *)object);
+        }
+
+        OBJECT_LINK(cache, object) = slab->free_list;
+        slab->free_list = (void *)object;
+        object += cache->slot_size;
+    }
+
+    kmem_slab_list_add(&cache->partial, slab);
+    cache->num_slabs++;
+    cache->num_empty++;
+
+    return slab;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    kmem_slab_t *slab = cache->partial;
+    if (slab == NULL)
+    {
+        slab = kmem_cache_grow(cache);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    void *object = slab->free_list;
+    slab->free_list = OBJECT_LINK(cache, object);
+    if (slab->num_active++ == 0)
+    {
+        cache->num_empty--;
+    }
+    cache->num_active++;
+
+    if (slab->free_list == NULL)
+    {
+        kmem_slab_list_remove(&cache->partial, slab);
+        kmem_slab_list_add(&cache->full, slab);
+    }
+
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+
+    kmem_slab_t *slab = OBJECT_SLAB(object);
+    if (slab->free_list == NULL)
+    {
+        kmem_slab_list_remove(&cache->full, slab);
+        kmem_slab_list_add(&cache->partial, slab);
+    }
+
+    OBJECT_LINK(cache, object) = slab->free_list;
+    slab->free_list = object;
+    cache->num_active--;
+
+    if (--slab->num_active > 0)
+    {
+        return;
+    }
+
+    // keep a single empty slab around so a cache that hovers around a slab
+    // boundary does not go back to the heap on every allocation
+    if (cache->num_empty == 0)
+    {
+        cache->num_empty++;
+        return;
+    }
+
+    kmem_slab_list_remove(&cache->partial, slab);
+    cache->num_slabs--;
+    kfree(slab);
+}
+
+kmem_cache_t *kmem_cache_list(void)
+{
+    return caches;
+}
@@ -0,0 +1,162 @@
+#include <kernel/vm_area.h>
+#include <kernel/memory_layout.h>
+#include <kernel/paging.h>
+#include <kernel/slab.h>
+#include <kernel/lib/string.h>
+
+static kmem_cache_t *vm_area_cache = NULL;
+
+static vm_area_t *vm_area_alloc(void)
+{
+    if (!vm_area_cache)
+    {
+        vm_area_cache = kmem_cache_create("vm_area_t", sizeof(vm_area_t), NULL);
+        if (!vm_area_cache)
+        {
+            return NULL;
+        }
+    }
+
+    return kmem_cache_alloc(vm_area_cache);
+}
+
+uint32_t vm_area_insert(vm_area_t **areas, uint32_t start, uint32_t end, uint32_t flags, fs_node_t *file, uint32_t file_offset, uint32_t file_size)
+{
+    if ((start % PAGE_SIZE) || (end % PAGE_SIZE) || start >= end || end > KERNEL_USER_SPACE_END)
+    {
+        return EINVARG;
+    }
+
+    // find the insertion point, areas must not overlap
+    vm_area_t **link = areas;
+    while (*link != NULL && (*link)->end <= start)
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link != NULL && (*link)->start < end)
+    {
+        return EINVARG;
+    }
+
+    vm_area_t *area = vm_area_alloc();
+    if (!area)
+    {
+        return ENOMEM;
+    }
+
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->file = file;
+    area->file_offset = file_offset;
+    area->file_size = file_size;
+
+    area->next = *link;
+    *link = area;
+
+    return EOK;
+}
+
+vm_area_t *vm_area_find(vm_area_t *areas, uint32_t address)
+{
+    for (vm_area_t *area = areas; area != NULL && area->start <= address; area = area->next)
+    {
+        if (address < area->end)
+        {
+            return area;
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t vm_area_clone(vm_area_t *areas, vm_area_t **clone)
+{
+    vm_area_t **link = clone;
+    for (vm_area_t *area = areas; area != NULL; area = area->next)
+    {
+        vm_area_t *copy = vm_area_alloc();
+        if (!copy)
+        {
+            vm_area_free_all(clone);
+            return ENOMEM;
+        }
+
+        memcpy(copy, area, sizeof(vm_area_t));
+        copy->next = NULL;
+        *link = copy;
+        link = &copy->next;
+    }
+
+    return EOK;
+}
+
+void vm_area_free_all(vm_area_t **areas)
+{
+    vm_area_t *area = *areas;
+    while (area != NULL)
+    {
+        vm_area_t *next = area->next;
+        kmem_cache_free(vm_area_cache, area);
+        area = next;
+    }
+
+    *areas = NULL;
+}
+
+uint32_t vm_area_fault(vm_area_t *area, uint32_t *directory, void *virt, uint32_t error_code)
+{
+    // present pages are only ever faulted on for protection reasons, copy on
+    // write is resolved before the areas are consulted
+    if (error_code & PAGING_FAULT_PRESENT)
+    {
+        return EINVARG;
+    }
+
+    if ((error_code & PAGING_FAULT_WRITE) && !(area->flags & VM_AREA_WRITE))
+    {
+        return EINVARG;
+    }
+
+    uint32_t page = (uint32_t)virt & ~(PAGE_SIZE - 1);
+    void *frame = page_alloc();
+    uint8_t *buffer = PHYS_TO_VIRT(frame);
+    memset(buffer, 0, PAGE_SIZE);
+
+    uint32_t offset = page - area->start;
+    if (area->file && offset < area->file_size)
+    {
+        uint32_t size = area->file_size - offset;
+        if (size > PAGE_SIZE)
+        {
+            size = PAGE_SIZE;
+        }
+
+        uint32_t res = read_fs(area->file, area->file_offset + offset, size, buffer);
+        if (res != EOK)
+        {
+            page_free(frame);
+            return res;
+        }
+    }
+
+    uint32_t flags = PAGING_IS_PRESENT;
+    if (area->flags & VM_AREA_WRITE)
+    {
+        flags |= PAGING_IS_WRITEABLE;
+    }
+    if (area->flags & VM_AREA_USER)
+    {
+        flags |= PAGING_ACCESS_FROM_ALL;
+    }
+
+    // the reference from page_alloc belongs to the mapping
+    uint32_t res = paging_map(directory, (void *)page, frame, flags);
+    if (res != EOK)
+    {
+        page_free(frame);
+    }
+
+    return res;
+}
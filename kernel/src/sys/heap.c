@@ -1,90 +1,428 @@
 #include <kernel/heap.h>
 #include <kernel/page_allocator.h>
 #include <kernel/paging.h>
+#include <kernel/tsc.h>
 #include <kernel/lib/string.h>
 
+#define HEAP_ALIGNMENT 8
+#define HEAP_NUM_SIZE_CLASSES 32
+
+#define HEAP_GROW_MIN_PAGES 16   // the heap grows by at least this many pages at once
+#define HEAP_SHRINK_MIN_PAGES 16 // free tail pages are only returned in batches of this size
+
+// next and prev link the chunks in address order and act as the boundary tags
+// used for coalescing, free_next and free_prev link the free chunks of one size class
 typedef struct memory_chunk
 {
     struct memory_chunk *next;
     struct memory_chunk *prev;
+    struct memory_chunk *free_next;
+    struct memory_chunk *free_prev;
     uint32_t size;
     bool allocated;
-} memory_chunk_t;
+#if HEAP_TRACK_ALLOCATION_SITES
+    void *site; // return address of the kmalloc caller
+#endif
+} __attribute__((aligned(HEAP_ALIGNMENT))) memory_chunk_t;
 
 struct
 {
     void *virtual_address;
     uint32_t size;
+    uint32_t min_size;
+    uint32_t max_size;
+    uint32_t *page_directory;
+    memory_chunk_t *last_chunk;
+
+    // size class n holds free chunks with 2^n <= size < 2^(n+1)
+    memory_chunk_t *free_lists[HEAP_NUM_SIZE_CLASSES];
+    uint32_t free_classes; // bit n is set when free_lists[n] is not empty
+
+    heap_stats_t stats;
 } heap_allocator;
 
-uint32_t heap_init(void *virtual_address, uint32_t num_pages, uint32_t *kernel_page_directory)
+static void account_allocation(memory_chunk_t *chunk, uint64_t start_cycles)
 {
-    if (num_pages < 1)
+    heap_allocator.stats.bytes_in_use += chunk->size;
+    if (heap_allocator.stats.bytes_in_use > heap_allocator.stats.peak_bytes_in_use)
     {
-        return -EINVARG;
+        heap_allocator.stats.peak_bytes_in_use = heap_allocator.stats.bytes_in_use;
     }
 
-    heap_allocator.virtual_address = virtual_address;
-    heap_allocator.size = num_pages * PAGE_SIZE;
+    heap_allocator.stats.num_allocations++;
+    heap_allocator.stats.allocate_cycles += tsc_read() - start_cycles;
+}
+
+static void *tag_allocation(void *ptr, void *site)
+{
+#if HEAP_TRACK_ALLOCATION_SITES
+    if (ptr != NULL)
+    {
+        ((memory_chunk_t *)((uint32_t)ptr - sizeof(memory_chunk_t)))->site = site;
+    }
+#else
+    (void)site;
+#endif
+    return ptr;
+}
+
+static uint32_t size_class(uint32_t size)
+{
+    return 31 - __builtin_clz(size);
+}
+
+static void free_list_insert(memory_chunk_t *chunk)
+{
+    uint32_t index = size_class(chunk->size);
+
+    chunk->allocated = false;
+    chunk->free_prev = NULL;
+    chunk->free_next = heap_allocator.free_lists[index];
+    if (chunk->free_next != NULL)
+    {
+        chunk->free_next->free_prev = chunk;
+    }
+
+    heap_allocator.free_lists[index] = chunk;
+    heap_allocator.free_classes |= (1UL << index);
+}
+
+static void free_list_remove(memory_chunk_t *chunk)
+{
+    uint32_t index = size_class(chunk->size);
+
+    if (chunk->free_prev != NULL)
+    {
+        chunk->free_prev->free_next = chunk->free_next;
+    }
+    else
+    {
+        heap_allocator.free_lists[index] = chunk->free_next;
+    }
+
+    if (chunk->free_next != NULL)
+    {
+        chunk->free_next->free_prev = chunk->free_prev;
+    }
 
-    void *current_virtual_address = virtual_address;
+    if (heap_allocator.free_lists[index] == NULL)
+    {
+        heap_allocator.free_classes &= ~(1UL << index);
+    }
+}
+
+static void map_pages(void *virtual_address, uint32_t num_pages)
+{
     for (uint32_t i = 0; i < num_pages; i++)
     {
         void *ptr = page_alloc();
-        paging_map(kernel_page_directory, current_virtual_address, ptr, PAGING_IS_PRESENT | PAGING_IS_WRITEABLE);
-        current_virtual_address += PAGE_SIZE;
+        paging_map(heap_allocator.page_directory, virtual_address, ptr, paging_kernel_flags());
+        virtual_address += PAGE_SIZE;
     }
+}
+
+static void unmap_pages(void *virtual_address, uint32_t num_pages)
+{
+    for (uint32_t i = 0; i < num_pages; i++)
+    {
+        void *ptr = paging_get_phys_address(heap_allocator.page_directory, virtual_address);
+        paging_unmap(heap_allocator.page_directory, virtual_address);
+        page_free(ptr);
+        virtual_address += PAGE_SIZE;
+    }
+}
+
+uint32_t heap_init(void *virtual_address, uint32_t num_pages, uint32_t max_pages, uint32_t *kernel_page_directory)
+{
+    if (num_pages < 1 || max_pages < num_pages)
+    {
+        return -EINVARG;
+    }
+
+    heap_allocator.virtual_address = virtual_address;
+    heap_allocator.size = num_pages * PAGE_SIZE;
+    heap_allocator.min_size = heap_allocator.size;
+    heap_allocator.max_size = max_pages * PAGE_SIZE;
+    heap_allocator.page_directory = kernel_page_directory;
+
+    map_pages(virtual_address, num_pages);
+
+    memset(heap_allocator.free_lists, 0, sizeof(heap_allocator.free_lists));
+    heap_allocator.free_classes = 0;
+    memset(&heap_allocator.stats, 0, sizeof(heap_stats_t));
 
     memory_chunk_t *first_chunk = (memory_chunk_t *)virtual_address;
-    first_chunk->allocated = false;
     first_chunk->prev = NULL;
     first_chunk->next = NULL;
     first_chunk->size = heap_allocator.size - sizeof(memory_chunk_t);
+    free_list_insert(first_chunk);
+    heap_allocator.last_chunk = first_chunk;
 
     return EOK;
 }
 
-static void *allocate(uint32_t size)
+static uint32_t heap_grow(uint32_t size)
 {
-    memory_chunk_t *result = NULL;
+    uint32_t num_pages = (size + sizeof(memory_chunk_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (num_pages < HEAP_GROW_MIN_PAGES)
+    {
+        num_pages = HEAP_GROW_MIN_PAGES;
+    }
 
-    for (memory_chunk_t *chunk = (memory_chunk_t *)heap_allocator.virtual_address; chunk != NULL && result == NULL; chunk = chunk->next)
+    if (heap_allocator.max_size - heap_allocator.size < num_pages * PAGE_SIZE)
     {
-        if (chunk->size > size && chunk->allocated == false)
+        num_pages = (heap_allocator.max_size - heap_allocator.size) / PAGE_SIZE;
+        if (num_pages * PAGE_SIZE < size + sizeof(memory_chunk_t))
         {
-            result = chunk;
+            return ENOMEM;
         }
     }
 
+    memory_chunk_t *chunk = (memory_chunk_t *)((uint32_t)heap_allocator.virtual_address + heap_allocator.size);
+    map_pages(chunk, num_pages);
+    heap_allocator.size += num_pages * PAGE_SIZE;
+
+    memory_chunk_t *last_chunk = heap_allocator.last_chunk;
+    if (last_chunk->allocated == false)
+    {
+        free_list_remove(last_chunk);
+        last_chunk->size += num_pages * PAGE_SIZE;
+        chunk = last_chunk;
+    }
+    else
+    {
+        chunk->size = num_pages * PAGE_SIZE - sizeof(memory_chunk_t);
+        chunk->prev = last_chunk;
+        chunk->next = NULL;
+        last_chunk->next = chunk;
+        heap_allocator.last_chunk = chunk;
+    }
+
+    free_list_insert(chunk);
+    return EOK;
+}
+
+// returns the whole pages at the end of the free last chunk to the frame allocator
+static void heap_shrink(memory_chunk_t *chunk)
+{
+    uint32_t heap_start = (uint32_t)heap_allocator.virtual_address;
+    uint32_t heap_end = heap_start + heap_allocator.size;
+
+    uint32_t keep_end = (uint32_t)chunk + sizeof(memory_chunk_t) + MINIMUM_ALLOCATION_SIZE;
+    keep_end = (keep_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (keep_end < heap_start + heap_allocator.min_size)
+    {
+        keep_end = heap_start + heap_allocator.min_size;
+    }
+
+    if (keep_end >= heap_end || (heap_end - keep_end) / PAGE_SIZE < HEAP_SHRINK_MIN_PAGES)
+    {
+        return;
+    }
+
+    unmap_pages((void *)keep_end, (heap_end - keep_end) / PAGE_SIZE);
+    heap_allocator.size = keep_end - heap_start;
+    chunk->size = keep_end - (uint32_t)chunk - sizeof(memory_chunk_t);
+}
+
+static memory_chunk_t *find_free_chunk(uint32_t size)
+{
+    // every chunk in a class above the one of size is large enough
+    uint32_t index = size_class(size);
+    uint32_t first_fit = ((size & (size - 1)) == 0) ? index : index + 1;
+
+    uint32_t available = (first_fit < HEAP_NUM_SIZE_CLASSES) ? heap_allocator.free_classes & ~((1UL << first_fit) - 1) : 0;
+    if (available != 0)
+    {
+        return heap_allocator.free_lists[__builtin_ctz(available)];
+    }
+
+    // chunks in the class of size itself may still be large enough
+    for (memory_chunk_t *chunk = heap_allocator.free_lists[index]; chunk != NULL; chunk = chunk->free_next)
+    {
+        if (chunk->size >= size)
+        {
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+static void split_chunk(memory_chunk_t *chunk, uint32_t size)
+{
+    if (chunk->size < size + sizeof(memory_chunk_t) + MINIMUM_ALLOCATION_SIZE)
+    {
+        return;
+    }
+
+    memory_chunk_t *new_chunk = (memory_chunk_t *)((uint32_t)chunk + sizeof(memory_chunk_t) + size);
+    new_chunk->size = chunk->size - size - sizeof(memory_chunk_t);
+    new_chunk->prev = chunk;
+    new_chunk->next = chunk->next;
+    if (new_chunk->next != NULL)
+    {
+        new_chunk->next->prev = new_chunk;
+    }
+
+    chunk->size = size;
+    chunk->next = new_chunk;
+    if (heap_allocator.last_chunk == chunk)
+    {
+        heap_allocator.last_chunk = new_chunk;
+    }
+
+    free_list_insert(new_chunk);
+}
+
+static void *allocate(uint32_t size)
+{
+    uint64_t start_cycles = tsc_read();
+
+    size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    if (size == 0)
+    {
+        size = HEAP_ALIGNMENT;
+    }
+
+    memory_chunk_t *result = find_free_chunk(size);
+    if (result == NULL && heap_grow(size) == EOK)
+    {
+        result = find_free_chunk(size);
+    }
+
     if (result == NULL)
     {
         PANIC_PRINT("out of kernel heap memory");
         return NULL;
     }
 
-    if (result->size >= size + sizeof(memory_chunk_t) + 1)
+    free_list_remove(result);
+    split_chunk(result, size);
+
+    result->allocated = true;
+    account_allocation(result, start_cycles);
+    return (void *)(((uint32_t)result) + sizeof(memory_chunk_t));
+}
+
+static void *allocate_aligned(uint32_t alignment, uint32_t size)
+{
+    if (alignment <= HEAP_ALIGNMENT)
+    {
+        return allocate(size);
+    }
+
+    if ((alignment & (alignment - 1)) != 0)
+    {
+        return NULL;
+    }
+
+    uint64_t start_cycles = tsc_read();
+
+    size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    if (size == 0)
+    {
+        size = HEAP_ALIGNMENT;
+    }
+
+    // room for the size itself, the alignment gap and a free chunk in front of it
+    uint32_t search_size = size + alignment + sizeof(memory_chunk_t) + MINIMUM_ALLOCATION_SIZE;
+
+    memory_chunk_t *chunk = find_free_chunk(search_size);
+    if (chunk == NULL && heap_grow(search_size) == EOK)
+    {
+        chunk = find_free_chunk(search_size);
+    }
+
+    if (chunk == NULL)
+    {
+        PANIC_PRINT("out of kernel heap memory");
+        return NULL;
+    }
+
+    free_list_remove(chunk);
+
+    uint32_t payload = (uint32_t)chunk + sizeof(memory_chunk_t);
+    if (payload % alignment != 0)
     {
-        memory_chunk_t *new_chunk = (memory_chunk_t *)((uint32_t)result + sizeof(memory_chunk_t) + size);
-        new_chunk->allocated = false;
-        new_chunk->size = result->size - size - sizeof(memory_chunk_t);
-        new_chunk->prev = result;
-        new_chunk->next = result->next;
-        if (new_chunk->next != NULL)
+        // split off the unaligned front as a free chunk of its own
+        uint32_t aligned_payload = payload + sizeof(memory_chunk_t) + MINIMUM_ALLOCATION_SIZE;
+        aligned_payload = (aligned_payload + alignment - 1) & ~(alignment - 1);
+
+        memory_chunk_t *aligned_chunk = (memory_chunk_t *)(aligned_payload - sizeof(memory_chunk_t));
+        aligned_chunk->size = chunk->size - (aligned_payload - payload);
+        aligned_chunk->prev = chunk;
+        aligned_chunk->next = chunk->next;
+        if (aligned_chunk->next != NULL)
         {
-            new_chunk->next->prev = new_chunk;
+            aligned_chunk->next->prev = aligned_chunk;
         }
 
-        result->size = size;
-        result->next = new_chunk;
+        chunk->next = aligned_chunk;
+        chunk->size = (uint32_t)aligned_chunk - payload;
+        if (heap_allocator.last_chunk == chunk)
+        {
+            heap_allocator.last_chunk = aligned_chunk;
+        }
+
+        free_list_insert(chunk);
+        chunk = aligned_chunk;
     }
 
-    result->allocated = true;
-    return (void *)(((uint32_t)result) + sizeof(memory_chunk_t));
+    split_chunk(chunk, size);
+
+    chunk->allocated = true;
+    account_allocation(chunk, start_cycles);
+    return (void *)(((uint32_t)chunk) + sizeof(memory_chunk_t));
+}
+
+static void release_chunk(memory_chunk_t *chunk)
+{
+    chunk->allocated = false;
+
+    if (chunk->prev != NULL && chunk->prev->allocated == false)
+    {
+        free_list_remove(chunk->prev);
+        chunk->prev->next = chunk->next;
+        chunk->prev->size += chunk->size + sizeof(memory_chunk_t);
+        if (chunk->next != NULL)
+        {
+            chunk->next->prev = chunk->prev;
+        }
+        if (heap_allocator.last_chunk == chunk)
+        {
+            heap_allocator.last_chunk = chunk->prev;
+        }
+
+        chunk = chunk->prev;
+    }
+
+    if (chunk->next != NULL && chunk->next->allocated == false)
+    {
+        free_list_remove(chunk->next);
+        chunk->size += chunk->next->size + sizeof(memory_chunk_t);
+        if (heap_allocator.last_chunk == chunk->next)
+        {
+            heap_allocator.last_chunk = chunk;
+        }
+        chunk->next = chunk->next->next;
+        if (chunk->next != NULL)
+        {
+            chunk->next->prev = chunk;
+        }
+    }
+
+    if (chunk == heap_allocator.last_chunk)
+    {
+        heap_shrink(chunk);
+    }
+
+    free_list_insert(chunk);
 }
 
 void *kmalloc(uint32_t size)
 {
-    void *result = allocate(size);
+    void *result = tag_allocation(allocate(size), __builtin_return_address(0));
     if (result == NULL)
     {
         return NULL;
@@ -96,27 +434,77 @@ void *kmalloc(uint32_t size)
 
 void *kmalloc_aligned(uint32_t alignment, uint32_t size)
 {
-    void *result = allocate(size + alignment); // TODO: this is very memory inefficiant
+    void *result = tag_allocation(allocate_aligned(alignment, size), __builtin_return_address(0));
     if (result == NULL)
     {
         return NULL;
     }
 
-    result = (uintptr_t)result + (alignment - ((uintptr_t)result % alignment));
-
     memset(result, 0x00, size);
     return result;
 }
 
 void *krealloc(void *ptr, uint32_t size)
 {
-    void *result = allocate(size);
+    if (ptr == NULL)
+    {
+        return tag_allocation(allocate(size), __builtin_return_address(0));
+    }
+
+    if (size == 0)
+    {
+        kfree(ptr);
+        return NULL;
+    }
+
+    memory_chunk_t *chunk = (memory_chunk_t *)((uint32_t)ptr - sizeof(memory_chunk_t));
+    uint32_t aligned_size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    uint32_t old_size = chunk->size;
+
+    // grow into the following chunk if it is free and large enough
+    memory_chunk_t *next = chunk->next;
+    if (aligned_size > chunk->size && next != NULL && next->allocated == false && chunk->size + sizeof(memory_chunk_t) + next->size >= aligned_size)
+    {
+        free_list_remove(next);
+        chunk->size += sizeof(memory_chunk_t) + next->size;
+        chunk->next = next->next;
+        if (chunk->next != NULL)
+        {
+            chunk->next->prev = chunk;
+        }
+        if (heap_allocator.last_chunk == next)
+        {
+            heap_allocator.last_chunk = chunk;
+        }
+    }
+
+    if (aligned_size <= chunk->size)
+    {
+        // shrink in place, the split off tail is freed so it merges with a free neighbour
+        next = chunk->next;
+        split_chunk(chunk, aligned_size);
+        if (chunk->next != next)
+        {
+            free_list_remove(chunk->next);
+            release_chunk(chunk->next);
+        }
+
+        heap_allocator.stats.bytes_in_use += chunk->size - old_size;
+        if (heap_allocator.stats.bytes_in_use > heap_allocator.stats.peak_bytes_in_use)
+        {
+            heap_allocator.stats.peak_bytes_in_use = heap_allocator.stats.bytes_in_use;
+        }
+
+        return ptr;
+    }
+
+    void *result = tag_allocation(allocate(size), __builtin_return_address(0));
     if (result == NULL)
     {
         return NULL;
     }
 
-    memcpy(result, ptr, size);
+    memcpy(result, ptr, chunk->size);
     kfree(ptr);
     return result;
 }
@@ -125,7 +513,7 @@ void *kcalloc(uint32_t num, uint32_t element_size)
 {
     uint32_t size = num * element_size;
 
-    void *result = allocate(size);
+    void *result = tag_allocation(allocate(size), __builtin_return_address(0));
     if (result == NULL)
     {
         return NULL;
@@ -137,28 +525,53 @@ void *kcalloc(uint32_t num, uint32_t element_size)
 
 void kfree(void *ptr)
 {
+    if (ptr == NULL)
+    {
+        return;
+    }
+
     memory_chunk_t *chunk = (memory_chunk_t *)((uint32_t)ptr - sizeof(memory_chunk_t));
-    chunk->allocated = false;
+    heap_allocator.stats.bytes_in_use -= chunk->size;
+    heap_allocator.stats.num_frees++;
 
-    if (chunk->prev != NULL && chunk->prev->allocated == false)
+    release_chunk(chunk);
+}
+
+void heap_get_stats(heap_stats_t *stats)
+{
+    memcpy(stats, &heap_allocator.stats, sizeof(heap_stats_t));
+    stats->heap_size = heap_allocator.size;
+    stats->num_chunks = 0;
+    stats->num_free_chunks = 0;
+    stats->largest_free_chunk = 0;
+
+    for (memory_chunk_t *chunk = (memory_chunk_t *)heap_allocator.virtual_address; chunk != NULL; chunk = chunk->next)
     {
-        chunk->prev->next = chunk->next;
-        chunk->prev->size += chunk->size + sizeof(memory_chunk_t);
-        if (chunk->next != NULL)
+        stats->num_chunks++;
+        if (chunk->allocated == false)
         {
-            chunk->next->prev = chunk->prev;
+            stats->num_free_chunks++;
+            if (chunk->size > stats->largest_free_chunk)
+            {
+                stats->largest_free_chunk = chunk->size;
+            }
         }
-
-        chunk = chunk->prev;
     }
+}
 
-    if (chunk->next != NULL && chunk->next->allocated == false)
+void heap_dump_allocations(void)
+{
+    for (memory_chunk_t *chunk = (memory_chunk_t *)heap_allocator.virtual_address; chunk != NULL; chunk = chunk->next)
     {
-        chunk->size += chunk->next->size + sizeof(memory_chunk_t);
-        chunk->next = chunk->next->next;
-        if (chunk->next != NULL)
+        if (chunk->allocated == false)
         {
-            chunk->next->prev = chunk;
+            continue;
         }
+
+#if HEAP_TRACK_ALLOCATION_SITES
+        kprintf("\t0x%x: %d bytes, allocated from 0x%x\n", (uint32_t)chunk + sizeof(memory_chunk_t), chunk->size, (uint32_t)chunk->site);
+#else
+        kprintf("\t0x%x: %d bytes\n", (uint32_t)chunk + sizeof(memory_chunk_t), chunk->size);
+#endif
     }
 }
@@ -7,6 +7,7 @@
 #include <kernel/lib/string.h>
 #include <kernel/lib/cast.h>
 #include <kernel/ports.h>
+#include <kernel/memory_layout.h>
 #include <kernel/page_allocator.h>
 #include <kernel/paging.h>
 #include <kernel/heap.h>
@@ -15,15 +16,23 @@
 #include <kernel/dev/tty/ega.h>
 #include <kernel/dev/input/keyboard_ps2.h>
 #include <kernel/dev/disk/ide.h>
+#include <kernel/dev/timer/pit.h>
 #include <kernel/shell.h>
 #include <kernel/fs/mbr.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/fs/initrd.h>
 #include <kernel/fs/fat32.h>
 #include <kernel/process.h>
+#include <kernel/syscall.h>
+#include <kernel/fpu.h>
+#include <kernel/workqueue.h>
+#include <kernel/ktime.h>
 
-#define KERNEL_ALLOCATOR_VADDR 0xFFFC0000
+#define KERNEL_ALLOCATOR_VADDR KERNEL_HEAP_VADDR
 #define KERNEL_ALLOCATOR_SIZE 0x40000
+#define KERNEL_ALLOCATOR_MAX_SIZE KERNEL_HEAP_MAX_SIZE
+
+#define KERNEL_TIMER_FREQUENCY 100 // Hz
 
 extern uint32_t _kernel_start;
 extern uint32_t _kernel_end;
@@ -34,6 +43,17 @@ struct tss tss;
 
 void pci_instantiate_drivers(void); // TODO: remove
 
+// runs once the scheduler started, the shell sleeps on keyboard input
+static void kernel_shell_thread(void *arg)
+{
+    (void)arg;
+
+    pci_instantiate_drivers();
+    kprintf("\033[40m  \033[41m  \033[42m  \033[43m  \033[44m  \033[45m  \033[46m  \033[47m  \033[40;1m  \033[41;1m  \033[42;1m  \033[43;1m  \033[44;1m  \033[45;1m  \033[46;1m  \033[47;1m  \033[0m\n");
+
+    run_kernel_shell();
+}
+
 void kernel_main(unsigned long magic, unsigned long addr)
 {
     disable_interrupts();
@@ -54,7 +74,8 @@ void kernel_main(unsigned long magic, unsigned long addr)
         return;
     }
 
-    for (struct multiboot_tag *tag = (struct multiboot_tag *)(addr + 8);
+    // the boot information is still addressed physically, reach it through the direct map
+    for (struct multiboot_tag *tag = (struct multiboot_tag *)PHYS_TO_VIRT(addr + 8);
          tag->type != MULTIBOOT_TAG_TYPE_END;
          tag = (struct multiboot_tag *)((multiboot_uint8_t *)tag + ((tag->size + 7) & ~7)))
     {
@@ -115,6 +136,8 @@ void kernel_main(unsigned long magic, unsigned long addr)
     uint32_t ebp_value;
     __asm__ volatile("movl %%ebp, %0" : "=r"(ebp_value));
 
+    // the boot stack is only used until the first task runs, task_switch
+    // points esp0 at the kernel stack of every task it switches to
     memset(&tss, 0, sizeof(struct tss));
     tss.esp0 = ebp_value;
     tss.ss0 = KERNEL_DATA_SELECTOR;
@@ -127,32 +150,50 @@ void kernel_main(unsigned long magic, unsigned long addr)
         PANIC_CODE(kprintf("failed to initialize interrupts. error: %s\n", string_error(result)));
     }
 
+    result = syscall_init(tss.esp0);
+    if (result != EOK)
+    {
+        PANIC_CODE(kprintf("failed to initialize syscalls. error: %s\n", string_error(result)));
+    }
+
+    result = fpu_init();
+    if (result != EOK)
+    {
+        PANIC_CODE(kprintf("failed to initialize fpu. error: %s\n", string_error(result)));
+    }
+
+    result = ktime_init();
+    if (result != EOK)
+    {
+        PANIC_CODE(kprintf("failed to initialize the clock. error: %s\n", string_error(result)));
+    }
+
     result = page_alloc_init(mmap, mmap_size);
     if (result != EOK)
     {
         PANIC_CODE(kprintf("failed to initialize page allocator. error: %s\n", string_error(result)));
     }
 
-    for (uint32_t i = ((uint32_t)&_kernel_start / PAGE_SIZE); i <= ((uint32_t)&_kernel_end / PAGE_SIZE); i++)
+    for (uint32_t i = ((uint32_t)VIRT_TO_PHYS(&_kernel_start) / PAGE_SIZE); i <= ((uint32_t)VIRT_TO_PHYS(&_kernel_end) / PAGE_SIZE); i++)
     {
         page_reserve((void *)(i * PAGE_SIZE));
     }
 
-    for (uint32_t i = ((uint32_t)initrd_start / PAGE_SIZE); i <= ((initrd_start / PAGE_SIZE) + ((uint32_t) * ((uint32_t *)initrd_start) / PAGE_SIZE)); i++)
+    for (uint32_t i = ((uint32_t)initrd_start / PAGE_SIZE); i <= ((initrd_start / PAGE_SIZE) + ((uint32_t) * ((uint32_t *)PHYS_TO_VIRT(initrd_start)) / PAGE_SIZE)); i++)
     {
         page_reserve((void *)(i * PAGE_SIZE));
     }
 
-    for (uint32_t i = ((uint32_t)addr / PAGE_SIZE); i <= ((uint32_t)(addr + *(uint32_t *)addr) / PAGE_SIZE); i++)
+    for (uint32_t i = ((uint32_t)addr / PAGE_SIZE); i <= ((uint32_t)(addr + *(uint32_t *)PHYS_TO_VIRT(addr)) / PAGE_SIZE); i++)
     {
         page_reserve((void *)(i * PAGE_SIZE));
     }
 
-    kernel_page_directory = page_directory_create(PAGING_IS_PRESENT | PAGING_IS_WRITEABLE | PAGING_ACCESS_FROM_ALL);
+    // paging is already enabled by the boot code, replace its directory
+    kernel_page_directory = paging_init();
     paging_switch_directory(kernel_page_directory);
-    paging_enable();
 
-    heap_init(KERNEL_ALLOCATOR_VADDR, KERNEL_ALLOCATOR_SIZE / PAGE_SIZE, kernel_page_directory);
+    heap_init((void *)KERNEL_ALLOCATOR_VADDR, KERNEL_ALLOCATOR_SIZE / PAGE_SIZE, KERNEL_ALLOCATOR_MAX_SIZE / PAGE_SIZE, kernel_page_directory);
 
     result = ide_driver_init();
     if (result != EOK)
@@ -202,16 +243,23 @@ void kernel_main(unsigned long magic, unsigned long addr)
         PANIC_CODE(kprintf("failed to load user program '/bin/blank.bin'\nerror code: %d\n", result));
     }
 
-    task_run_first_task();
-
-    pci_instantiate_drivers();
-    kprintf("\033[40m  \033[41m  \033[42m  \033[43m  \033[44m  \033[45m  \033[46m  \033[47m  \033[40;1m  \033[41;1m  \033[42;1m  \033[43;1m  \033[44;1m  \033[45;1m  \033[46;1m  \033[47;1m  \033[0m\n");
+    result = workqueue_init();
+    if (result != EOK)
+    {
+        PANIC_CODE(kprintf("failed to initialize workqueues. error: %s\n", string_error(result)));
+    }
 
-    run_kernel_shell();
+    result = pit_init(KERNEL_TIMER_FREQUENCY, schedule);
+    if (result != EOK)
+    {
+        PANIC_CODE(kprintf("failed to initialize pit. error: %s\n", string_error(result)));
+    }
 
-    while (true)
+    if (!task_new_kernel_thread(kernel_shell_thread, NULL, 0))
     {
+        PANIC_PRINT("failed to start the kernel shell");
     }
 
-    __asm__("int $3"); // Breakpoint exception
+    // does not return, the boot stack is abandoned
+    task_run_first_task();
 }
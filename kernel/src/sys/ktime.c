@@ -0,0 +1,63 @@
+#include <kernel/ktime.h>
+#include <kernel/tsc.h>
+#include <kernel/dev/timer/pit.h>
+#include <kernel/lib/math.h>
+
+// cycles are converted with ns = cycles * mult >> KTIME_SHIFT, which avoids a
+// 64 bit division on every read
+#define KTIME_SHIFT 24
+
+static uint32_t ktime_tsc_khz = 0; // 0 without a tsc, time then comes from the pit
+static uint32_t ktime_mult = 0;
+static uint64_t ktime_tsc_base = 0;
+
+// calibrates the tsc against the pit, time starts at 0 here
+uint32_t ktime_init(void)
+{
+    ktime_tsc_khz = tsc_calibrate();
+    if (ktime_tsc_khz == 0)
+    {
+        return EOK;
+    }
+
+    ktime_mult = (uint32_t)div_u64((uint64_t)NSEC_PER_MSEC << KTIME_SHIFT, ktime_tsc_khz, NULL);
+    ktime_tsc_base = tsc_read();
+
+    return EOK;
+}
+
+uint64_t ktime_cycles_to_ns(uint64_t cycles)
+{
+    if (ktime_mult == 0)
+    {
+        return 0;
+    }
+
+    // split so the products fit in 64 bits
+    uint32_t low = (uint32_t)cycles;
+    uint32_t high = (uint32_t)(cycles >> 32);
+    return (((uint64_t)low * ktime_mult) >> KTIME_SHIFT) + (((uint64_t)high * ktime_mult) << (32 - KTIME_SHIFT));
+}
+
+// monotonic nanoseconds since ktime_init. without a tsc the resolution is one
+// timer interrupt
+uint64_t ktime_get_ns(void)
+{
+    if (ktime_tsc_khz == 0)
+    {
+        uint32_t frequency = pit_get_frequency();
+        if (frequency == 0)
+        {
+            return 0;
+        }
+
+        return (uint64_t)pit_get_ticks() * (NSEC_PER_SEC / frequency);
+    }
+
+    return ktime_cycles_to_ns(tsc_read() - ktime_tsc_base);
+}
+
+uint32_t ktime_get_tsc_khz(void)
+{
+    return ktime_tsc_khz;
+}
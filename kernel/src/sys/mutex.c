@@ -0,0 +1,50 @@
+#include <kernel/mutex.h>
+
+void mutex_init(mutex_t *mutex)
+{
+    mutex->locked = false;
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->waiters);
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+    uint32_t flags = interrupts_save();
+    if (mutex->locked && mutex->owner == task_current())
+    {
+        PANIC_PRINT("mutex_lock: the mutex is already held by the current task");
+    }
+
+    while (mutex->locked)
+    {
+        sleep_on(&mutex->waiters);
+    }
+
+    mutex->locked = true;
+    mutex->owner = task_current();
+    interrupts_restore(flags);
+}
+
+bool mutex_trylock(mutex_t *mutex)
+{
+    uint32_t flags = interrupts_save();
+    bool acquired = !mutex->locked;
+    if (acquired)
+    {
+        mutex->locked = true;
+        mutex->owner = task_current();
+    }
+    interrupts_restore(flags);
+
+    return acquired;
+}
+
+// the first waiter is woken and competes for the mutex again
+void mutex_unlock(mutex_t *mutex)
+{
+    uint32_t flags = interrupts_save();
+    mutex->locked = false;
+    mutex->owner = NULL;
+    wake_up(&mutex->waiters);
+    interrupts_restore(flags);
+}
@@ -1,10 +1,11 @@
 #include <kernel/process.h>
 #include <kernel/heap.h>
+#include <kernel/slab.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/lib/string.h>
 
-process_t *current_process = NULL;
 static process_t *processes[KERNEL_MAX_PROCESSES] = {};
+static kmem_cache_t *process_cache = NULL;
 
 static void process_init(process_t *process)
 {
@@ -13,7 +14,8 @@ static void process_init(process_t *process)
 
 process_t *process_current()
 {
-    return current_process;
+    task_t *task = task_current();
+    return task ? task->process : NULL;
 }
 
 process_t *process_get(uint32_t index)
@@ -26,35 +28,19 @@ process_t *process_get(uint32_t index)
     return processes[index];
 }
 
+// the image stays open, its pages are read through the image area when first touched
 static uint32_t process_load_binary(const char *path, process_t *process)
 {
-    uint32_t res = EOK;
     fs_node_t *file = open_fs(path);
     if (!file)
     {
-        res = EIO;
-        return res;
-    }
-
-    void *program_data_ptr = kmalloc_aligned(PAGE_SIZE, file->filesize);
-    if (!program_data_ptr)
-    {
-        res = ENOMEM;
-        goto out;
-    }
-
-    res = read_fs(file, 0, file->filesize, program_data_ptr);
-    if (res != EOK)
-    {
-        goto out;
+        return EIO;
     }
 
-    process->data = program_data_ptr;
+    process->image = file;
     process->size = file->filesize;
 
-out:
-    close_fs(file);
-    return res;
+    return EOK;
 }
 
 static uint32_t process_load_data(const char *path, process_t *process)
@@ -64,26 +50,58 @@ static uint32_t process_load_data(const char *path, process_t *process)
     return res;
 }
 
-extern uint32_t *kernel_page_directory;
+uint32_t process_handle_fault(process_t *process, void *virt, uint32_t error_code)
+{
+    if (!process)
+    {
+        return EINVARG;
+    }
+
+    vm_area_t *area = vm_area_find(process->areas, (uint32_t)virt);
+    if (!area)
+    {
+        return EINVARG;
+    }
+
+    return vm_area_fault(area, process->task->page_directory, virt, error_code);
+}
 
-uint32_t process_map_binary(process_t *process)
+// ends the current process. its pages go with the page directory once the
+// task is reaped, which happens after it left the cpu
+void process_exit(void)
 {
-    uint32_t res = EOK;
-    void *data_phys_addr = paging_get_phys_address(kernel_page_directory, process->data);
-    res = paging_map_to(process->task->page_directory, (void *)KERNEL_TASK_VADDR, data_phys_addr, paging_align_address(data_phys_addr + process->size), PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL | PAGING_IS_WRITEABLE);
-    return res;
+    process_t *process = process_current();
+    if (process)
+    {
+        processes[process->id] = NULL;
+        vm_area_free_all(&process->areas);
+        if (process->image)
+        {
+            close_fs(process->image);
+        }
+
+        process->task->process = NULL;
+        kmem_cache_free(process_cache, process);
+    }
+
+    task_exit();
 }
 
+// nothing is mapped up front, the areas are backed page by page as they are touched
 uint32_t process_map_memory(process_t *process)
 {
     uint32_t res = EOK;
-    res = process_map_binary(process);
-    if (res != EOK)
+    if (process->size > 0)
     {
-        goto out;
+        uint32_t image_end = (uint32_t)paging_align_address((void *)(KERNEL_TASK_VADDR + process->size));
+        res = vm_area_insert(&process->areas, KERNEL_TASK_VADDR, image_end, VM_AREA_WRITE | VM_AREA_USER, process->image, 0, process->size);
+        if (res != EOK)
+        {
+            goto out;
+        }
     }
 
-    // res = paging_map_to(process->task->page_directory, (void *)(KERNEL_TASK_STACK_VADDR - KERNEL_TASK_STACK_SIZE), process->stack, paging_align_address(process->stack + KERNEL_TASK_STACK_SIZE), PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL | PAGING_IS_WRITEABLE);
+    res = vm_area_insert(&process->areas, KERNEL_TASK_STACK_VADDR - KERNEL_TASK_STACK_SIZE, KERNEL_TASK_STACK_VADDR, VM_AREA_WRITE | VM_AREA_USER, NULL, 0, 0);
 
 out:
     return res;
@@ -94,7 +112,6 @@ uint32_t process_load_for_slot(const char *path, process_t **process, uint32_t p
     uint32_t res = EOK;
     task_t *task = NULL;
     process_t *_process = NULL;
-    void *program_stack_ptr = NULL;
 
     if (process_get(process_slot) != NULL)
     {
@@ -102,7 +119,17 @@ uint32_t process_load_for_slot(const char *path, process_t **process, uint32_t p
         goto out;
     }
 
-    _process = kmalloc(sizeof(process_t));
+    if (!process_cache)
+    {
+        process_cache = kmem_cache_create("process_t", sizeof(process_t), NULL);
+        if (!process_cache)
+        {
+            res = ENOMEM;
+            goto out;
+        }
+    }
+
+    _process = kmem_cache_alloc(process_cache);
     if (!_process)
     {
         res = ENOMEM;
@@ -113,19 +140,10 @@ uint32_t process_load_for_slot(const char *path, process_t **process, uint32_t p
     res = process_load_data(path, _process);
     if (res != EOK)
     {
-        kfree(_process);
+        kmem_cache_free(process_cache, _process);
         goto out;
     }
 
-    program_stack_ptr = kmalloc_aligned(PAGE_SIZE, KERNEL_TASK_STACK_SIZE);
-    if (!program_stack_ptr)
-    {
-        // TODO: memory leak... unload process
-        res = -ENOMEM;
-        goto out;
-    }
-
-    _process->stack = program_stack_ptr;
     strncpy(_process->path, path, sizeof(_process->path));
 
     _process->id = process_slot;
@@ -145,6 +163,7 @@ uint32_t process_load_for_slot(const char *path, process_t **process, uint32_t p
     if (res != EOK)
     {
         // TODO: memory leak... unload process
+        vm_area_free_all(&_process->areas);
         task_free(task);
         goto out;
     }
@@ -186,3 +205,59 @@ uint32_t process_load(const char *path, process_t **process)
 out:
     return res;
 }
+
+uint32_t process_fork(process_t *parent, const int_registers_t *frame, process_t **process)
+{
+    uint32_t res = EOK;
+    process_t *_process = NULL;
+    int32_t process_slot = process_get_free_slot();
+    if (process_slot < 0)
+    {
+        res = ENOMEM;
+        goto out;
+    }
+
+    _process = kmem_cache_alloc(process_cache);
+    if (!_process)
+    {
+        res = ENOMEM;
+        goto out;
+    }
+
+    process_init(_process);
+    strncpy(_process->path, parent->path, sizeof(_process->path));
+    _process->id = (uint32_t)process_slot;
+
+    // pages the parent already touched are shared copy on write through the
+    // page directory, the rest is backed on demand through the same areas. the
+    // child holds its own reference on the image its areas read from
+    _process->image = parent->image ? dup_fs(parent->image) : NULL;
+    _process->size = parent->size;
+
+    res = vm_area_clone(parent->areas, &_process->areas);
+    if (res == EOK)
+    {
+        _process->task = task_fork(parent->task, _process, frame);
+        if (!_process->task)
+        {
+            vm_area_free_all(&_process->areas);
+            res = ENOMEM;
+        }
+    }
+
+    if (res != EOK)
+    {
+        if (_process->image)
+        {
+            close_fs(_process->image);
+        }
+        kmem_cache_free(process_cache, _process);
+        goto out;
+    }
+
+    *process = _process;
+    processes[process_slot] = _process;
+
+out:
+    return res;
+}
@@ -0,0 +1,51 @@
+#include <kernel/semaphore.h>
+
+void semaphore_init(semaphore_t *semaphore, uint32_t count)
+{
+    semaphore->count = count;
+    wait_queue_init(&semaphore->waiters);
+}
+
+void semaphore_down(semaphore_t *semaphore)
+{
+    uint32_t flags = interrupts_save();
+    wait_event(&semaphore->waiters, semaphore->count > 0);
+    semaphore->count--;
+    interrupts_restore(flags);
+}
+
+// gives up after ticks timer ticks, returns false when the count stayed 0
+bool semaphore_down_timeout(semaphore_t *semaphore, uint32_t ticks)
+{
+    uint32_t flags = interrupts_save();
+    bool acquired = wait_event_timeout(&semaphore->waiters, semaphore->count > 0, ticks) != 0;
+    if (acquired)
+    {
+        semaphore->count--;
+    }
+    interrupts_restore(flags);
+
+    return acquired;
+}
+
+bool semaphore_trydown(semaphore_t *semaphore)
+{
+    uint32_t flags = interrupts_save();
+    bool acquired = semaphore->count > 0;
+    if (acquired)
+    {
+        semaphore->count--;
+    }
+    interrupts_restore(flags);
+
+    return acquired;
+}
+
+// safe to call from interrupt handlers
+void semaphore_up(semaphore_t *semaphore)
+{
+    uint32_t flags = interrupts_save();
+    semaphore->count++;
+    wake_up(&semaphore->waiters);
+    interrupts_restore(flags);
+}
@@ -1,11 +1,14 @@
 #include <kernel/shell.h>
 #include <kernel/dev/block_device.h>
 #include <kernel/heap.h>
+#include <kernel/slab.h>
 #include <kernel/page_allocator.h>
 #include <kernel/lib/string.h>
 #include <kernel/lib/ascii.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/dev/input_device.h>
+#include <kernel/ktime.h>
+#include <kernel/lib/math.h>
 
 struct command_info
 {
@@ -77,7 +80,7 @@ void process_command(char *line, uint32_t len)
 
     if (strcmp(command_info.command, "help") == 0)
     {
-        kprintf("list of commands:\n - help: prints this message\n - sysinfo: gives you info about the kernel version\n - ls: list files in directory\n - print: prints the content of the specified file\n - page: dynamicly allocates a page and prints it\n - dumpdisks: prints information about scanned block devices\n - echo: echoes arguments\n");
+        kprintf("list of commands:\n - help: prints this message\n - sysinfo: gives you info about the kernel version\n - ls: list files in directory\n - print: prints the content of the specified file\n - page: dynamicly allocates a page and prints it\n - dumpdisks: prints information about scanned block devices\n - echo: echoes arguments\n - heapstat: prints kernel heap statistics ('heapstat chunks' lists live allocations)\n - uptime: prints the time since boot\n");
     }
     else if (strcmp(command_info.command, "sysinfo") == 0)
     {
@@ -182,6 +185,39 @@ void process_command(char *line, uint32_t len)
             kprintf("\t%s: id %d, offset %d, num blocks %d, type %d\n", logical_block_device->device_name, logical_block_device->device_id, logical_block_device->lba_offset, logical_block_device->num_blocks, type);
         }
     }
+    else if (strcmp(command_info.command, "heapstat") == 0)
+    {
+        heap_stats_t stats = {};
+        heap_get_stats(&stats);
+
+        kprintf("kernel heap:\n");
+        kprintf("\tsize %d bytes, in use %d bytes, peak %d bytes\n", stats.heap_size, stats.bytes_in_use, stats.peak_bytes_in_use);
+        kprintf("\t%d chunks, %d free, largest free chunk %d bytes\n", stats.num_chunks, stats.num_free_chunks, stats.largest_free_chunk);
+        uint32_t allocate_us = (uint32_t)div_u64(ktime_cycles_to_ns(stats.allocate_cycles), NSEC_PER_USEC, NULL);
+        kprintf("\t%d allocations, %d frees, %d kcycles (%d us) spent allocating\n", stats.num_allocations, stats.num_frees, (uint32_t)(stats.allocate_cycles >> 10), allocate_us);
+
+        kprintf("object caches:\n");
+        for (kmem_cache_t *cache = kmem_cache_list(); cache != NULL; cache = cache->next)
+        {
+            kprintf("\t%s: object size %d, %d active, %d slabs of %d objects\n", cache->name, cache->object_size, cache->num_active, cache->num_slabs, cache->objects_per_slab);
+        }
+
+        kprintf("physical pages: %d free of %d\n", get_num_free_pages(), get_num_pages());
+
+        if (command_info.num_arguments >= 2 && strcmp(command_info.arguments[1], "chunks") == 0)
+        {
+            kprintf("live allocations:\n");
+            heap_dump_allocations();
+        }
+    }
+    else if (strcmp(command_info.command, "uptime") == 0)
+    {
+        uint32_t ms;
+        uint32_t seconds = (uint32_t)div_u64(ktime_get_ns(), NSEC_PER_SEC, &ms);
+        ms /= NSEC_PER_MSEC;
+
+        kprintf("up %d.%d%d%d s, tsc %d kHz\n", seconds, ms / 100, (ms / 10) % 10, ms % 10, ktime_get_tsc_khz());
+    }
     else if (strcmp(command_info.command, "echo") == 0)
     {
         for (uint32_t i = 1; i < command_info.num_arguments; i++)
@@ -208,8 +244,10 @@ void run_kernel_shell()
 
     while (true)
     {
+        uint32_t notifications = input_device_notifications();
         input_device_t **input_devices = get_input_devices();
         uint32_t num_input_devices = get_num_input_devices();
+        bool received_event = false;
 
         for (uint32_t i = 0; i < num_input_devices; i++)
         {
@@ -221,6 +259,8 @@ void run_kernel_shell()
                 continue;
             }
 
+            received_event = true;
+
             uint32_t key = event.data[0];
 
             uint8_t ascii_key = key_code_to_ascii(key);
@@ -253,5 +293,11 @@ void run_kernel_shell()
             kprintf("%c", ascii_key);
             line[line_len++] = ascii_key;
         }
+
+        // input arrives through interrupts, sleep until a device reports some instead of polling
+        if (!received_event)
+        {
+            input_device_wait(notifications);
+        }
     }
 }
@@ -0,0 +1,111 @@
+#include <kernel/syscall.h>
+#include <kernel/memory_layout.h>
+#include <kernel/process.h>
+
+static syscall_handler_t syscall_table[SYSCALL_MAX] = {};
+
+// user pointers must lie completely below the kernel and inside the areas of
+// the process, a fault outside of them would be taken in ring 0
+static bool syscall_user_range(uint32_t address, uint32_t size)
+{
+    if (address + size < address || address + size > KERNEL_USER_SPACE_END)
+    {
+        return false;
+    }
+
+    process_t *process = process_current();
+    if (!process)
+    {
+        return false;
+    }
+
+    uint32_t end = address + size;
+    while (address < end)
+    {
+        vm_area_t *area = vm_area_find(process->areas, address);
+        if (!area)
+        {
+            return false;
+        }
+
+        address = area->end;
+    }
+
+    return true;
+}
+
+static uint32_t syscall_write(int_registers_t *, uint32_t buffer, uint32_t size, uint32_t)
+{
+    if (!syscall_user_range(buffer, size))
+    {
+        return EINVARG;
+    }
+
+    // user pages that are not backed yet are faulted in on access
+    const char *str = (const char *)buffer;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        kprintf("%c", str[i]);
+    }
+
+    return EOK;
+}
+
+static uint32_t syscall_getpid(int_registers_t *, uint32_t, uint32_t, uint32_t)
+{
+    process_t *process = process_current();
+    return process ? process->id : 0;
+}
+
+// the child resumes from a copy of the frame the parent entered the kernel with
+static uint32_t syscall_fork(int_registers_t *regs, uint32_t, uint32_t, uint32_t)
+{
+    process_t *parent = process_current();
+    if (!parent)
+    {
+        return (uint32_t)-1;
+    }
+
+    process_t *child;
+    uint32_t res = process_fork(parent, regs, &child);
+    if (res != EOK)
+    {
+        return (uint32_t)-1;
+    }
+
+    return child->id;
+}
+
+uint32_t syscall_init(uint32_t kernel_stack)
+{
+    syscall_register(SYSCALL_WRITE, syscall_write);
+    syscall_register(SYSCALL_GETPID, syscall_getpid);
+    syscall_register(SYSCALL_FORK, syscall_fork);
+
+    syscall_arch_init(kernel_stack);
+
+    return EOK;
+}
+
+uint32_t syscall_register(uint32_t number, syscall_handler_t handler)
+{
+    if (number >= SYSCALL_MAX)
+    {
+        return EINVARG;
+    }
+
+    syscall_table[number] = handler;
+    return EOK;
+}
+
+// called from the entry stubs with the registers of the caller
+uint32_t syscall_dispatch(int_registers_t *regs)
+{
+    uint32_t number = regs->eax;
+    if (number >= SYSCALL_MAX || syscall_table[number] == NULL)
+    {
+        return EINVARG;
+    }
+
+    return syscall_table[number](regs, regs->ebx, regs->esi, regs->edi);
+}
@@ -1,20 +1,151 @@
 #include <kernel/task.h>
 #include <kernel/heap.h>
+#include <kernel/slab.h>
 #include <kernel/segmentation.h>
 #include <kernel/lib/string.h>
+#include <kernel/workqueue.h>
+
+// interrupts enabled, bit 1 is reserved and always set
+#define TASK_INITIAL_EFLAGS 0x202
+
+extern uint32_t *kernel_page_directory;
+extern struct tss tss;
 
 task_t *current_task = NULL;
-task_t *task_tail = NULL;
-task_t *task_head = NULL;
+
+// runs in ring 0 whenever no other task is ready, it is never queued
+static task_t *idle_task = NULL;
+
+// frame the interrupt in progress returns through, set when the scheduler switched tasks
+static int_registers_t *resume_frame = NULL;
+
+// a task that should run before the current one became ready
+static bool need_resched = false;
+
+// ready tasks, one queue per priority level with a bit set for every non empty one
+static task_queue_t run_queues[TASK_PRIORITY_LEVELS];
+static uint32_t run_queue_bitmap[(TASK_PRIORITY_LEVELS + 31) / 32];
+
+static task_queue_t blocked_tasks;
+static task_queue_t dead_tasks;     // their kernel stack may still be in use
+static work_t task_reap_work;       // frees dead_tasks outside of the scheduler
+
+static kmem_cache_t *task_cache = NULL;
 
 task_t *task_current()
 {
     return current_task;
 }
 
+static void task_queue_push(task_queue_t *queue, task_t *task)
+{
+    task->next = NULL;
+    task->prev = queue->tail;
+    if (queue->tail)
+    {
+        queue->tail->next = task;
+    }
+    else
+    {
+        queue->head = task;
+    }
+    queue->tail = task;
+}
+
+static void task_queue_remove(task_queue_t *queue, task_t *task)
+{
+    if (task->prev)
+    {
+        task->prev->next = task->next;
+    }
+    else
+    {
+        queue->head = task->next;
+    }
+
+    if (task->next)
+    {
+        task->next->prev = task->prev;
+    }
+    else
+    {
+        queue->tail = task->prev;
+    }
+
+    task->next = NULL;
+    task->prev = NULL;
+}
+
+static uint32_t task_priority(task_t *task)
+{
+    return (uint32_t)(task->nice - TASK_NICE_MIN);
+}
+
+static void run_queue_add(task_t *task)
+{
+    uint32_t priority = task_priority(task);
+    task->state = TASK_READY;
+    task_queue_push(&run_queues[priority], task);
+    run_queue_bitmap[priority / 32] |= (1UL << (priority % 32));
+
+    if (!current_task || current_task == idle_task || priority < task_priority(current_task))
+    {
+        need_resched = true;
+    }
+}
+
+static void run_queue_remove(task_t *task)
+{
+    uint32_t priority = task_priority(task);
+    task_queue_remove(&run_queues[priority], task);
+    if (run_queues[priority].head == NULL)
+    {
+        run_queue_bitmap[priority / 32] &= ~(1UL << (priority % 32));
+    }
+}
+
+// highest priority level with a ready task, TASK_PRIORITY_LEVELS when there is none
+static uint32_t run_queue_highest(void)
+{
+    for (uint32_t i = 0; i < sizeof(run_queue_bitmap) / sizeof(run_queue_bitmap[0]); i++)
+    {
+        if (run_queue_bitmap[i])
+        {
+            return i * 32 + __builtin_ctz(run_queue_bitmap[i]);
+        }
+    }
+
+    return TASK_PRIORITY_LEVELS;
+}
+
+static task_t *task_alloc(void)
+{
+    if (!task_cache)
+    {
+        task_cache = kmem_cache_create("task_t", sizeof(task_t), NULL);
+        if (!task_cache)
+        {
+            return NULL;
+        }
+    }
+
+    return kmem_cache_alloc(task_cache);
+}
+
+static uintptr_t task_kernel_stack_top(task_t *task)
+{
+    return (uintptr_t)task->kernel_stack + KERNEL_TASK_KERNEL_STACK_SIZE;
+}
+
+// the frame an interrupt from user mode leaves at the top of the kernel stack
+static int_registers_t *task_user_frame(task_t *task)
+{
+    return (int_registers_t *)task_kernel_stack_top(task) - 1;
+}
+
 task_t *task_new(struct _process *process)
 {
-    task_t *task = kmalloc(sizeof(task_t));
+    task_t *task = task_alloc();
     if (!task)
     {
         return NULL;
@@ -23,112 +154,508 @@ task_t *task_new(struct _process *process)
     uint32_t res = task_init(task, process);
     if (res != EOK)
     {
-        kfree(task);
+        kmem_cache_free(task_cache, task);
         return NULL;
     }
 
-    if (task_head == NULL)
+    run_queue_add(task);
+    return task;
+}
+
+task_t *task_fork(task_t *parent, struct _process *process, const int_registers_t *frame)
+{
+    task_t *task = task_alloc();
+    if (!task)
     {
-        task_head = task;
-        task_tail = task;
-        current_task = task;
+        return NULL;
     }
-    else
+
+    memset(task, 0, sizeof(task_t));
+    task->kernel_stack = kmalloc(KERNEL_TASK_KERNEL_STACK_SIZE);
+    if (!task->kernel_stack)
+    {
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
+
+    task->page_directory = page_directory_fork(parent->page_directory);
+    if (!task->page_directory)
+    {
+        kfree(task->kernel_stack);
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
+
+    if (fpu_fork(parent, task) != EOK)
     {
-        task_tail->next = task;
-        task->prev = task_tail;
-        task_tail = task;
+        page_directory_free(task->page_directory);
+        kfree(task->kernel_stack);
+        kmem_cache_free(task_cache, task);
+        return NULL;
     }
 
+    // the child continues where the parent entered the kernel, but sees 0 as the result
+    task->frame = task_user_frame(task);
+    memcpy(task->frame, frame, sizeof(int_registers_t));
+    task->frame->eax = 0;
+    task->time_slice = KERNEL_TASK_TIME_SLICE;
+    task->nice = parent->nice;
+    task->process = process;
+
+    run_queue_add(task);
     return task;
 }
 
+// the ready task with the highest priority, it stays queued
 task_t *task_get_next()
 {
-    if (!current_task->next)
+    uint32_t priority = run_queue_highest();
+    if (priority == TASK_PRIORITY_LEVELS)
     {
-        return task_head;
+        return NULL;
     }
 
-    return current_task->next;
+    return run_queues[priority].head;
 }
 
-static void task_list_remove(task_t *task)
+static void task_detach(task_t *task)
 {
-    if (task->prev)
+    switch (task->state)
     {
-        task->prev->next = task->next;
+    case TASK_READY:
+        run_queue_remove(task);
+        break;
+    case TASK_BLOCKED:
+        task_queue_remove(task->wait_queue, task);
+        task->wait_queue = NULL;
+        timer_del(&task->sleep_timer);
+        break;
+    case TASK_SLEEPING:
+        timer_del(&task->sleep_timer);
+        break;
+    case TASK_DEAD:
+        task_queue_remove(&dead_tasks, task);
+        break;
+    default:
+        break;
     }
+}
 
-    if (task == task_head)
+void task_free(task_t *task)
+{
+    task_detach(task);
+    if (task == current_task)
     {
-        task_head = task->next;
+        current_task = NULL;
     }
 
-    if (task == task_tail)
+    fpu_release(task);
+    if (task->page_directory != kernel_page_directory)
     {
-        task_tail = task->prev;
+        page_directory_free(task->page_directory);
     }
+    kfree(task->kernel_stack);
+    kmem_cache_free(task_cache, task);
+}
 
-    if (task == current_task)
+static int32_t task_clamp_nice(int32_t nice)
+{
+    if (nice < TASK_NICE_MIN)
+    {
+        return TASK_NICE_MIN;
+    }
+    else if (nice > TASK_NICE_MAX)
     {
-        current_task = task_get_next();
+        return TASK_NICE_MAX;
     }
+
+    return nice;
 }
 
-void task_free(task_t *task)
+void task_set_nice(task_t *task, int32_t nice)
 {
-    page_directory_free(task->page_directory);
-    task_list_remove(task);
-    kfree(task);
+    nice = task_clamp_nice(nice);
+    if (task->state == TASK_READY)
+    {
+        run_queue_remove(task);
+        task->nice = nice;
+        run_queue_add(task);
+        return;
+    }
+
+    task->nice = nice;
 }
 
-uint32_t task_switch(task_t *task)
+void task_block(task_t *task)
 {
-    current_task = task;
-    paging_switch_directory(task->page_directory);
-    return EOK;
+    if (task->state == TASK_BLOCKED)
+    {
+        return;
+    }
+
+    task_block_on(task, &blocked_tasks);
 }
 
-uint32_t task_page()
+// queue is usually the list of a wait queue, task_unblock takes the task off it again
+void task_block_on(task_t *task, task_queue_t *queue)
 {
-    user_registers();
-    task_switch(current_task);
-    return EOK;
+    task_detach(task);
+    task->state = TASK_BLOCKED;
+    task->wait_queue = queue;
+    task_queue_push(queue, task);
 }
 
-void task_run_first_task()
+void task_unblock(task_t *task)
+{
+    if (task->state != TASK_BLOCKED && task->state != TASK_SLEEPING)
+    {
+        return;
+    }
+
+    task_detach(task);
+    run_queue_add(task);
+}
+
+static void task_sleep_expired(timer_t *timer)
+{
+    task_unblock(timer->data);
+}
+
+void task_sleep(task_t *task, uint32_t ticks)
+{
+    task_detach(task);
+    task->state = TASK_SLEEPING;
+
+    timer_init(&task->sleep_timer, task_sleep_expired, task);
+    timer_mod(&task->sleep_timer, ticks);
+}
+
+// blocks on queue like task_block_on, but the task is unblocked after ticks
+// even without a wake up. the timer is cancelled once the task leaves the queue
+void task_block_timeout(task_t *task, task_queue_t *queue, uint32_t ticks)
+{
+    task_block_on(task, queue);
+
+    timer_init(&task->sleep_timer, task_sleep_expired, task);
+    timer_mod(&task->sleep_timer, ticks);
+}
+
+// frees the tasks that exited. it runs on the system workqueue, so their
+// stacks are no longer in use and the interrupt path does not free memory
+static void task_reap(work_t *work)
 {
-    if (!task_head)
+    (void)work;
+
+    uint32_t flags = interrupts_save();
+    task_t *task = dead_tasks.head;
+    while (task)
     {
-        PANIC_PRINT("task_run_first_task: task_head is NULL");
+        task_t *next = task->next;
+        if (task != current_task)
+        {
+            task_free(task);
+        }
+        task = next;
     }
+    interrupts_restore(flags);
+}
 
-    current_task = task_head;
+// gives up the cpu, the current task stays ready unless it blocked or went
+// to sleep before. kernel threads are not preempted and have to call this
+void task_yield(void)
+{
+    __asm__ volatile("int %0" : : "i"(INTERRUPT_YIELD) : "memory");
+}
 
-    // TODO: this is just a workaround for now
-    // TODO: long term the kernel heap needs to be mapped into tasks page directories as well
-    task_registers_t regs;
-    memcpy(&regs, &task_head->registers, sizeof(task_registers_t));
-    task_switch(task_head);
-    task_return(&regs);
+// ends the current task, it is freed once it is off the cpu
+void task_exit(void)
+{
+    interrupts_save();
+    current_task->state = TASK_DEAD;
+    task_queue_push(&dead_tasks, current_task);
+    workqueue_queue(workqueue_system(), &task_reap_work);
+    task_yield();
+
+    PANIC_PRINT("task_exit: a dead task was resumed");
+}
+
+uint32_t task_switch(task_t *task)
+{
+    current_task = task;
+    paging_switch_directory(task->page_directory);
+
+    // interrupts from user mode enter the kernel on the stack of the running task
+    tss.esp0 = task_kernel_stack_top(task);
+    fpu_switch(task);
+    return EOK;
 }
 
 uint32_t task_init(task_t *task, struct _process *process)
 {
     memset(task, 0, sizeof(task_t));
-    task->page_directory = page_directory_create(PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL); // TODO: remove flags
+    task->kernel_stack = kmalloc(KERNEL_TASK_KERNEL_STACK_SIZE);
+    if (!task->kernel_stack)
+    {
+        return ENOMEM;
+    }
+
+    task->page_directory = page_directory_create();
     if (!task->page_directory)
     {
+        kfree(task->kernel_stack);
         return ENOMEM;
     }
 
-    task->registers.ip = KERNEL_TASK_VADDR;
-    task->registers.ss = USER_DATA_SELECTOR;
-    task->registers.cs = USER_CODE_SELECTOR;
-    task->registers.esp = KERNEL_TASK_STACK_VADDR;
+    // the first switch to the task "returns" to the start of the binary
+    int_registers_t *frame = task_user_frame(task);
+    memset(frame, 0, sizeof(int_registers_t));
+    frame->gs = USER_DATA_SELECTOR;
+    frame->fs = USER_DATA_SELECTOR;
+    frame->es = USER_DATA_SELECTOR;
+    frame->ds = USER_DATA_SELECTOR;
+    frame->eip = KERNEL_TASK_VADDR;
+    frame->cs = USER_CODE_SELECTOR;
+    frame->eflags = TASK_INITIAL_EFLAGS;
+    frame->useresp = KERNEL_TASK_STACK_VADDR;
+    frame->ss = USER_DATA_SELECTOR;
+    task->frame = frame;
 
+    task->time_slice = KERNEL_TASK_TIME_SLICE;
     task->process = process;
 
     return EOK;
 }
+
+static void task_idle_loop(void)
+{
+    while (true)
+    {
+        wait_for_interrupt();
+    }
+}
+
+static void task_kernel_thread_start(void)
+{
+    current_task->entry(current_task->arg);
+    task_exit();
+}
+
+// a task that runs start in ring 0, it is not queued yet
+static task_t *task_new_kernel(void (*start)(void), int32_t nice)
+{
+    task_t *task = task_alloc();
+    if (!task)
+    {
+        return NULL;
+    }
+
+    memset(task, 0, sizeof(task_t));
+    task->kernel_stack = kmalloc(KERNEL_TASK_KERNEL_STACK_SIZE);
+    if (!task->kernel_stack)
+    {
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
+
+    // an interrupt in ring 0 does not switch stacks, so the frame has no useresp and ss
+    int_registers_t *frame = (int_registers_t *)(task_kernel_stack_top(task) - INT_REGISTERS_KERNEL_SIZE);
+    memset(frame, 0, INT_REGISTERS_KERNEL_SIZE);
+    frame->gs = KERNEL_DATA_SELECTOR;
+    frame->fs = KERNEL_DATA_SELECTOR;
+    frame->es = KERNEL_DATA_SELECTOR;
+    frame->ds = KERNEL_DATA_SELECTOR;
+    frame->eip = (uint32_t)start;
+    frame->cs = KERNEL_CODE_SELECTOR;
+    frame->eflags = TASK_INITIAL_EFLAGS;
+    task->frame = frame;
+
+    task->page_directory = kernel_page_directory;
+    task->time_slice = KERNEL_TASK_TIME_SLICE;
+    task->nice = task_clamp_nice(nice);
+
+    return task;
+}
+
+task_t *task_new_kernel_thread(task_entry_t entry, void *arg, int32_t nice)
+{
+    task_t *task = task_new_kernel(task_kernel_thread_start, nice);
+    if (!task)
+    {
+        return NULL;
+    }
+
+    task->entry = entry;
+    task->arg = arg;
+
+    uint32_t flags = interrupts_save();
+    run_queue_add(task);
+    interrupts_restore(flags);
+
+    return task;
+}
+
+// the timer runs in one shot mode and is programmed for the next point in
+// time the scheduler has to look at: the end of the time slice when another
+// task is waiting for the cpu and the next timer on the wheel, which includes
+// the wake up of sleeping tasks
+void task_program_timer(void)
+{
+    uint32_t ticks = timer_next_event();
+    if (current_task && current_task != idle_task && run_queue_highest() != TASK_PRIORITY_LEVELS && current_task->time_slice < ticks)
+    {
+        ticks = current_task->time_slice;
+    }
+
+    timer_program(ticks);
+}
+
+static void task_run(task_t *task)
+{
+    if (task != idle_task)
+    {
+        run_queue_remove(task);
+    }
+
+    task->state = TASK_RUNNING;
+    task_switch(task);
+}
+
+// the interrupted task keeps its frame on its kernel stack, the interrupt
+// returns through the frame of the next task instead
+static void task_switch_from(int_registers_t *regs, task_t *next)
+{
+    if (current_task)
+    {
+        current_task->frame = regs;
+    }
+
+    task_run(next);
+    resume_frame = next->frame;
+}
+
+// only user mode and the idle task are preempted, the kernel is not reentrant
+// yet so kernel code gives up the cpu itself
+static bool task_preemptible(int_registers_t *regs)
+{
+    return !current_task || current_task == idle_task || (regs->cs & 3) == 3;
+}
+
+// the current task is switched out once its time slice is used up, when it
+// stopped being runnable or when a task with a higher priority became ready
+static void task_reschedule(int_registers_t *regs)
+{
+    need_resched = false;
+
+    // the idle task gives way as soon as anything is ready, a freed current
+    // task has nothing to save and is replaced by whatever can run
+    if (!current_task || current_task == idle_task)
+    {
+        task_t *next = task_get_next();
+        if (next || !current_task)
+        {
+            task_switch_from(regs, next ? next : idle_task);
+        }
+
+        return;
+    }
+
+    bool running = current_task->state == TASK_RUNNING;
+    if (running && current_task->time_slice > 0 && run_queue_highest() >= task_priority(current_task))
+    {
+        return;
+    }
+
+    task_t *previous = current_task;
+    previous->time_slice = KERNEL_TASK_TIME_SLICE;
+    if (running)
+    {
+        run_queue_add(previous);
+    }
+
+    task_t *next = task_get_next();
+    if (next == previous)
+    {
+        run_queue_remove(previous);
+        previous->state = TASK_RUNNING;
+        return;
+    }
+
+    task_switch_from(regs, next ? next : idle_task);
+}
+
+// called by the interrupt handlers before returning, gives the frame to resume.
+// a task woken by the interrupt that should run before the current one gets
+// the cpu right away instead of at the next timer interrupt
+int_registers_t *task_interrupt_return(int_registers_t *regs)
+{
+    if (need_resched && !resume_frame && task_preemptible(regs))
+    {
+        task_reschedule(regs);
+    }
+
+    if (resume_frame)
+    {
+        regs = resume_frame;
+        resume_frame = NULL;
+    }
+
+    return regs;
+}
+
+static void task_yield_handler(int_registers_t *regs)
+{
+    if (current_task && current_task != idle_task)
+    {
+        current_task->time_slice = 0;
+    }
+
+    task_reschedule(regs);
+}
+
+// called from the timer interrupt with the number of ticks that passed
+void schedule(int_registers_t *regs, uint32_t ticks)
+{
+    timer_advance(ticks);
+
+    if (current_task && current_task != idle_task)
+    {
+        current_task->ticks += ticks;
+        current_task->time_slice = current_task->time_slice > ticks ? current_task->time_slice - ticks : 0;
+    }
+
+    if (task_preemptible(regs))
+    {
+        task_reschedule(regs);
+    }
+
+    task_program_timer();
+}
+
+void task_run_first_task()
+{
+    idle_task = task_new_kernel(task_idle_loop, TASK_NICE_MAX);
+    if (!idle_task)
+    {
+        PANIC_PRINT("task_run_first_task: failed to create the idle task");
+    }
+
+    task_t *task = task_get_next();
+    if (!task)
+    {
+        PANIC_PRINT("task_run_first_task: no task is ready");
+    }
+
+    register_interrupt_handler(INTERRUPT_YIELD, task_yield_handler);
+    work_init(&task_reap_work, task_reap);
+
+    task_run(task);
+    task_program_timer();
+
+    // the boot stack is abandoned, from now on the kernel runs on task stacks
+    __asm__ volatile("mov %0, %%esp\n"
+                     "jmp interrupt_return"
+                     :
+                     : "r"(task->frame)
+                     : "memory");
+    __builtin_unreachable();
+}
@@ -0,0 +1,265 @@
+#include <kernel/timer.h>
+#include <kernel/interrupts.h>
+#include <kernel/dev/timer/pit.h>
+#include <kernel/task.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_INDEX(tick, level) (((tick) >> ((level) * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK)
+
+static timer_t *timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+static uint32_t timer_wheel_bitmap[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE / 32]; // non empty slots
+
+static uint32_t timer_ticks = 0; // ticks that passed
+static uint32_t timer_next = 0;  // next tick whose slot has not been run yet
+
+// tick the timer interrupt is programmed for, earlier timers reprogram it
+static bool timer_armed = false;
+static uint32_t timer_programmed = 0;
+
+// timers of the slot being run, they stay removable while the callbacks run
+static timer_t *timer_expired = NULL;
+
+void timer_init(timer_t *timer, timer_func_t func, void *data)
+{
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+    timer->slot = NULL;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void timer_wheel_insert(timer_t *timer)
+{
+    // timers that are already due go into the slot that runs next
+    uint32_t delay = timer->expires - timer_next;
+    uint32_t expires = timer->expires;
+    if ((int32_t)delay < 0)
+    {
+        delay = 0;
+        expires = timer_next;
+    }
+    else if (delay > TIMER_WHEEL_MAX_DELAY)
+    {
+        // parked on the last level and inserted again when it cascades
+        delay = TIMER_WHEEL_MAX_DELAY;
+        expires = timer_next + TIMER_WHEEL_MAX_DELAY;
+    }
+
+    uint32_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delay >= (1UL << ((level + 1) * TIMER_WHEEL_BITS)))
+    {
+        level++;
+    }
+
+    uint32_t index = TIMER_WHEEL_INDEX(expires, level);
+    timer_t **slot = &timer_wheel[level][index];
+
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot)
+    {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+
+    timer_wheel_bitmap[level][index / 32] |= (1UL << (index % 32));
+}
+
+static void timer_wheel_remove(timer_t *timer)
+{
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        *timer->slot = timer->next;
+    }
+
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+
+    if (*timer->slot == NULL && timer->slot != &timer_expired)
+    {
+        uint32_t position = timer->slot - &timer_wheel[0][0];
+        uint32_t level = position / TIMER_WHEEL_SIZE;
+        uint32_t index = position % TIMER_WHEEL_SIZE;
+        timer_wheel_bitmap[level][index / 32] &= ~(1UL << (index % 32));
+    }
+
+    timer->slot = NULL;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// expires is an absolute tick count, see timer_get_ticks
+void timer_add(timer_t *timer, uint32_t expires)
+{
+    uint32_t flags = interrupts_save();
+    if (timer->slot)
+    {
+        timer_wheel_remove(timer);
+    }
+
+    timer->expires = expires;
+    timer_wheel_insert(timer);
+
+    if (timer_armed && (int32_t)(expires - timer_programmed) < 0)
+    {
+        task_program_timer();
+    }
+    interrupts_restore(flags);
+}
+
+// timer_ticks only advances when the timer interrupt arrives. the period in
+// progress counts as passed, so a timer armed in the middle of it is not early
+static uint32_t timer_now(void)
+{
+    return timer_ticks + pit_get_pending_ticks();
+}
+
+// (re)arms the timer to expire ticks from now
+void timer_mod(timer_t *timer, uint32_t ticks)
+{
+    timer_add(timer, timer_now() + ticks);
+}
+
+void timer_del(timer_t *timer)
+{
+    uint32_t flags = interrupts_save();
+    if (timer->slot)
+    {
+        timer_wheel_remove(timer);
+    }
+    interrupts_restore(flags);
+}
+
+bool timer_pending(timer_t *timer)
+{
+    return timer->slot != NULL;
+}
+
+// moves the timers of one slot a level down, they land in the slots of the level below
+static void timer_wheel_cascade(uint32_t level, uint32_t index)
+{
+    timer_t *timer = timer_wheel[level][index];
+    timer_wheel[level][index] = NULL;
+    timer_wheel_bitmap[level][index / 32] &= ~(1UL << (index % 32));
+
+    while (timer)
+    {
+        timer_t *next = timer->next;
+        timer_wheel_insert(timer);
+        timer = next;
+    }
+}
+
+static void timer_wheel_run_next(void)
+{
+    uint32_t index = TIMER_WHEEL_INDEX(timer_next, 0);
+    if (index == 0)
+    {
+        // every wrap of a level brings the next slot of the level above down
+        for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            uint32_t level_index = TIMER_WHEEL_INDEX(timer_next, level);
+            timer_wheel_cascade(level, level_index);
+            if (level_index != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    timer_expired = timer_wheel[0][index];
+    timer_wheel[0][index] = NULL;
+    timer_wheel_bitmap[0][index / 32] &= ~(1UL << (index % 32));
+    for (timer_t *timer = timer_expired; timer; timer = timer->next)
+    {
+        timer->slot = &timer_expired;
+    }
+
+    // timers the callbacks add for this tick again go into the next slot
+    timer_next++;
+
+    while (timer_expired)
+    {
+        timer_t *timer = timer_expired;
+        timer_wheel_remove(timer);
+        timer->func(timer);
+    }
+}
+
+// called from the timer interrupt with the number of ticks that passed, runs
+// every timer that expired in the meantime
+void timer_advance(uint32_t ticks)
+{
+    // the programmed interrupt arrived, it is programmed again once the timers ran
+    timer_armed = false;
+    timer_ticks += ticks;
+    while ((int32_t)(timer_ticks - timer_next) >= 0)
+    {
+        timer_wheel_run_next();
+    }
+}
+
+// ticks until the wheel has to be advanced again, 0xFFFFFFFF when no timer is
+// pending. timers on the upper levels only bound this by the next wrap of the
+// lowest level, where they may be cascaded
+uint32_t timer_next_event(void)
+{
+    uint32_t ticks = 0xFFFFFFFF;
+    uint32_t start = TIMER_WHEEL_INDEX(timer_next, 0);
+
+    for (uint32_t i = 0; i < TIMER_WHEEL_SIZE; i++)
+    {
+        uint32_t index = (start + i) & TIMER_WHEEL_MASK;
+        if (timer_wheel_bitmap[0][index / 32] & (1UL << (index % 32)))
+        {
+            ticks = i;
+            break;
+        }
+    }
+
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (uint32_t i = 0; i < TIMER_WHEEL_SIZE / 32; i++)
+        {
+            uint32_t until_wrap = (TIMER_WHEEL_SIZE - start) & TIMER_WHEEL_MASK;
+            if (timer_wheel_bitmap[level][i] && until_wrap < ticks)
+            {
+                ticks = until_wrap;
+            }
+        }
+    }
+
+    if (ticks == 0xFFFFFFFF)
+    {
+        return ticks;
+    }
+
+    // timer_next is one tick ahead of the ticks that already passed
+    return ticks + (timer_next - timer_ticks);
+}
+
+uint32_t timer_get_ticks(void)
+{
+    return timer_ticks;
+}
+
+// programs the timer interrupt ticks after the last one, see timer_next_event
+void timer_program(uint32_t ticks)
+{
+    timer_programmed = timer_ticks + pit_set_oneshot(ticks);
+    timer_armed = true;
+}
+
+// rounded up to whole ticks
+uint32_t timer_ms_to_ticks(uint32_t ms)
+{
+    return (ms * pit_get_frequency() + 999) / 1000;
+}
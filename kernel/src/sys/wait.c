@@ -0,0 +1,106 @@
+#include <kernel/wait.h>
+#include <kernel/ktime.h>
+
+void wait_queue_init(wait_queue_t *queue)
+{
+    queue->tasks.head = NULL;
+    queue->tasks.tail = NULL;
+}
+
+// blocks the current task until a wake_up on the queue. it may also return
+// early, callers check their condition again. before the first task runs
+// there is nothing to switch to and this only halts until the next interrupt
+void sleep_on(wait_queue_t *queue)
+{
+    uint32_t flags = interrupts_save();
+
+    task_t *task = task_current();
+    if (!task)
+    {
+        wait_for_interrupt();
+    }
+    else
+    {
+        task_block_on(task, &queue->tasks);
+        task_yield();
+    }
+
+    interrupts_restore(flags);
+}
+
+// safe to call from interrupt handlers
+void wake_up(wait_queue_t *queue)
+{
+    uint32_t flags = interrupts_save();
+    if (queue->tasks.head)
+    {
+        task_unblock(queue->tasks.head);
+    }
+    interrupts_restore(flags);
+}
+
+void wake_up_all(wait_queue_t *queue)
+{
+    uint32_t flags = interrupts_save();
+    while (queue->tasks.head)
+    {
+        task_unblock(queue->tasks.head);
+    }
+    interrupts_restore(flags);
+}
+
+// like sleep_on, but returns after ticks at the latest. returns the ticks that
+// were left, 0 once the timeout passed. before the first task runs there is no
+// timer to wake us and this halts like sleep_on without using up the timeout
+uint32_t sleep_on_timeout(wait_queue_t *queue, uint32_t ticks)
+{
+    uint32_t flags = interrupts_save();
+
+    task_t *task = task_current();
+    if (!task)
+    {
+        wait_for_interrupt();
+    }
+    else if (ticks > 0)
+    {
+        uint32_t expires = timer_get_ticks() + ticks;
+        task_block_timeout(task, &queue->tasks, ticks);
+        task_yield();
+
+        int32_t left = (int32_t)(expires - timer_get_ticks());
+        ticks = left > 0 ? (uint32_t)left : 0;
+    }
+
+    interrupts_restore(flags);
+    return ticks;
+}
+
+void sleep_ticks(uint32_t ticks)
+{
+    uint32_t flags = interrupts_save();
+
+    task_t *task = task_current();
+    if (task && ticks > 0)
+    {
+        task_sleep(task, ticks);
+        task_yield();
+    }
+
+    interrupts_restore(flags);
+}
+
+// rounded up to whole timer ticks. before the first task runs nothing else
+// could use the cpu, so this spins on the clock instead
+void sleep_ms(uint32_t ms)
+{
+    if (!task_current())
+    {
+        uint64_t deadline = ktime_get_ns() + (uint64_t)ms * NSEC_PER_MSEC;
+        while (ktime_get_ns() < deadline)
+        {
+        }
+        return;
+    }
+
+    sleep_ticks(timer_ms_to_ticks(ms));
+}
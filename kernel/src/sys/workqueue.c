@@ -0,0 +1,96 @@
+#include <kernel/workqueue.h>
+#include <kernel/heap.h>
+
+static workqueue_t *system_workqueue = NULL;
+
+void work_init(work_t *work, work_func_t func)
+{
+    work->func = func;
+    work->pending = false;
+    work->next = NULL;
+}
+
+static void workqueue_worker(void *arg)
+{
+    workqueue_t *queue = arg;
+    while (true)
+    {
+        wait_event(&queue->wait, queue->head != NULL);
+
+        // interrupt handlers queue work too
+        uint32_t flags = interrupts_save();
+        work_t *work = queue->head;
+        queue->head = work->next;
+        if (!queue->head)
+        {
+            queue->tail = NULL;
+        }
+        work->pending = false;
+        interrupts_restore(flags);
+
+        work->func(work);
+    }
+}
+
+workqueue_t *workqueue_create(int32_t nice)
+{
+    workqueue_t *queue = kmalloc(sizeof(workqueue_t));
+    if (!queue)
+    {
+        return NULL;
+    }
+
+    queue->head = NULL;
+    queue->tail = NULL;
+    wait_queue_init(&queue->wait);
+    queue->worker = task_new_kernel_thread(workqueue_worker, queue, nice);
+    if (!queue->worker)
+    {
+        kfree(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+uint32_t workqueue_init(void)
+{
+    system_workqueue = workqueue_create(WORKQUEUE_SYSTEM_NICE);
+    if (!system_workqueue)
+    {
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+workqueue_t *workqueue_system(void)
+{
+    return system_workqueue;
+}
+
+// safe to call from interrupt handlers, returns false when the work is already pending
+bool workqueue_queue(workqueue_t *queue, work_t *work)
+{
+    uint32_t flags = interrupts_save();
+    bool queued = !work->pending;
+    if (queued)
+    {
+        work->pending = true;
+        work->next = NULL;
+        if (queue->tail)
+        {
+            queue->tail->next = work;
+        }
+        else
+        {
+            queue->head = work;
+        }
+        queue->tail = work;
+
+        wake_up(&queue->wait);
+    }
+    interrupts_restore(flags);
+
+    return queued;
+}